@@ -13,54 +13,661 @@
 #include <sstream>
 #include <condition_variable>
 #include <regex>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <cstdint>
+#include <string_view>
+#include <queue>
+#include <cstring>
+#include <cstdio>
+#include <unordered_map>
+#include <iterator>
+#include <shared_mutex>
+#include <bitset>
+#include <map>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define QFS_X86_64 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include <sys/mman.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <sys/un.h>
+#include <dirent.h>
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define QFS_HAVE_IO_URING 1
+#endif
+#endif
 
 #include "rang.hpp"
 
 namespace fs = std::filesystem;
 
-// Global synchronization primitives
-std::mutex coutMutex;                    // Protects std::cout
-std::mutex resultsMutex;                 // Protects searchResults vector
-std::mutex threadsMutex;                 // Protects threads vector
-std::condition_variable threadsCV;       // Signals when threads complete
-
 // Thread management
-std::atomic<int> activeThreads(0);       // Count of currently running threads
-std::atomic<int> maxThreads(std::thread::hardware_concurrency()); // Maximum allowed threads
+std::atomic<int> maxThreads(std::thread::hardware_concurrency()); // Number of traversal workers
 
-// Search results and control
-std::vector<std::string> searchResults;  // Stores found file paths
-std::vector<std::thread> threads;        // Active search threads
+// Search control
 std::atomic<bool> printDuringSearch(true); // Controls real-time output
 bool searchDirectories = false;          // Search directory names as well
+size_t maxResults = 0;                   // --max-results/--first: stop after this many matches (0 = all)
+std::atomic<size_t> resultCount(0);      // Matches recorded so far, counted only when maxResults is set
+std::atomic<bool> searchCancelled(false); // Set once maxResults matches are recorded; workers stop early
 
 // Save to file
 std::string saveFilename;                // If not empty, results will be saved to this file
 
+// Filename index and resident daemon
+std::string indexFilename = "qfs.idx";   // Index written by --index build and read by --index query
+std::string socketFilename;              // Daemon socket (default: daemonSocketPath())
+std::string contentPattern;              // --contains: only report files whose content matches
+std::vector<std::pair<std::string, std::string>> metadataOptions; // --size/--mtime/--newer and their values
+std::vector<std::string> excludePatterns; // --exclude rules (.gitignore syntax)
+bool useIgnoreFiles = false;             // --ignore-files: honor .gitignore and .qfsignore in every directory
+bool sameFileSystem = false;             // --xdev: do not enter other mounts
+std::vector<std::string> skipFileSystemTypes; // --skip-fstype, on top of the pseudo file systems
+
+// Batched queries
+std::vector<std::string> batchQueries;   // --queries lines; results are tagged with the one that matched
+bool splitSaveByQuery = false;           // --split: save each query's results to its own file
+
+enum class RunMode {
+    SEARCH,         // Walk the file system (default)
+    INDEX_BUILD,    // Walk once and write the index
+    INDEX_UPDATE,   // Re-read only directories that changed since the index was written
+    INDEX_QUERY,    // Match against the index instead of the file system
+    DAEMON,         // Keep the tree in memory and answer queries over a socket
+    CLIENT          // Forward the query to a running daemon
+};
+
+bool recordDirectoryStamps = false;      // Record each searched directory's stamp (index build/update)
+
+enum class IoBackend {
+    SYNC,           // One blocking stat/open per entry that needs it
+    URING           // Batch each directory's statx and openat calls through io_uring (Linux)
+};
+
+IoBackend ioBackend = IoBackend::SYNC;   // --io-backend
+
 // Search modes and regex flag
 enum class SearchMode {
-    OR,     // Match any pattern (default)
-    AND,    // Match all patterns
-    SINGLE  // Single pattern
+    OR,        // Match any pattern (default)
+    AND,       // Match all patterns
+    SINGLE,    // Single pattern
+    EXPRESSION // Boolean expression with !, parentheses or mixed operators and types
 };
 
 enum class PatternType {
     SIMPLE, // Simple substring search (case-insensitive)
-    REGEX   // Regular expression
+    REGEX,  // Regular expression
+    GLOB    // Shell glob matched against the whole name (case-insensitive)
+};
+
+/**
+ * A found file or directory; the "Found ... at:" text is only produced on output
+ */
+struct MatchRecord {
+    std::string path;        // Absolute path
+    uint32_t nameOffset;     // Start of the file name within path
+    bool isDirectory;
+    uint32_t query = 0;      // Index into batchQueries
+
+    std::string_view name() const {
+        return std::string_view(path).substr(nameOffset);
+    }
+};
+
+/**
+ * Formats a record the way results are printed and saved; with --queries the
+ * line starts with the matching query in brackets unless withQuery is false
+ */
+std::string formatMatch(const MatchRecord& record, bool withQuery = true) {
+    std::string text;
+    if (withQuery && !batchQueries.empty()) {
+        text.append("[").append(batchQueries[record.query]).append("] ");
+    }
+    text += record.isDirectory ? "Found directory " : "Found ";
+    text.append(record.name()).append(" at: ").append(record.path);
+    return text;
+}
+
+/**
+ * Identity and modification time of a directory, used to detect which
+ * directories an index update has to read again
+ */
+struct DirectoryStamp {
+    int64_t mtimeSeconds = 0;
+    int64_t mtimeNanoseconds = 0;
+    uint64_t inode = 0;
+    uint64_t device = 0;
+
+    bool operator==(const DirectoryStamp& other) const {
+        return mtimeSeconds == other.mtimeSeconds && mtimeNanoseconds == other.mtimeNanoseconds &&
+            inode == other.inode && device == other.device;
+    }
+
+    bool operator!=(const DirectoryStamp& other) const {
+        return !(*this == other);
+    }
+};
+
+/**
+ * Stamp of a directory that was opened during the traversal
+ */
+struct StampRecord {
+    std::string path;        // Absolute path
+    DirectoryStamp stamp;
+};
+
+/**
+ * Result order: by path, then by query when several --queries match one path
+ */
+inline bool recordBefore(const MatchRecord& a, const MatchRecord& b) {
+    const int order = a.path.compare(b.path);
+    return order < 0 || (order == 0 && a.query < b.query);
+}
+
+inline bool recordBefore(const StampRecord& a, const StampRecord& b) {
+    return a.path < b.path;
+}
+
+/**
+ * Collects records into one buffer per worker thread so recording a hit never
+ * contends on a lock. Buffers are sorted in parallel and k-way merged by path
+ * once the traversal has finished.
+ */
+template <typename Record>
+class ResultCollector {
+public:
+    /**
+     * Appends a record to the calling thread's buffer
+     */
+    void add(Record record) {
+        if (!local) {
+            // First record on this thread: register its buffer once
+            std::lock_guard<std::mutex> lock(buffersMutex);
+            buffers.push_back(std::make_unique<std::vector<Record>>());
+            local = buffers.back().get();
+        }
+        local->push_back(std::move(record));
+    }
+
+    /**
+     * Sorts every buffer and merges them into a single list ordered by path.
+     * Must only be called after all workers have stopped adding.
+     */
+    std::vector<Record> merge() {
+        auto byPath = [](const Record& a, const Record& b) { return recordBefore(a, b); };
+
+        std::vector<std::thread> sorters;
+        size_t total = 0;
+        for (auto& buffer : buffers) {
+            total += buffer->size();
+            sorters.emplace_back([&buffer, byPath]() {
+                std::sort(buffer->begin(), buffer->end(), byPath);
+                });
+        }
+        for (auto& sorter : sorters) {
+            sorter.join();
+        }
+
+        // Heap of (buffer, position) ordered by the record at that position
+        using Cursor = std::pair<size_t, size_t>;
+        auto later = [this](const Cursor& a, const Cursor& b) {
+            return recordBefore((*buffers[b.first])[b.second], (*buffers[a.first])[a.second]);
+            };
+        std::priority_queue<Cursor, std::vector<Cursor>, decltype(later)> heap(later);
+        for (size_t i = 0; i < buffers.size(); i++) {
+            if (!buffers[i]->empty()) {
+                heap.push({ i, 0 });
+            }
+        }
+
+        std::vector<Record> merged;
+        merged.reserve(total);
+        while (!heap.empty()) {
+            Cursor cursor = heap.top();
+            heap.pop();
+            merged.push_back(std::move((*buffers[cursor.first])[cursor.second]));
+            if (++cursor.second < buffers[cursor.first]->size()) {
+                heap.push(cursor);
+            }
+        }
+
+        buffers.clear();
+        return merged;
+    }
+
+private:
+    std::mutex buffersMutex;             // Protects buffers during registration
+    std::vector<std::unique_ptr<std::vector<Record>>> buffers;
+    static thread_local std::vector<Record>* local;
+};
+
+template <typename Record>
+thread_local std::vector<Record>* ResultCollector<Record>::local = nullptr;
+
+ResultCollector<MatchRecord> resultCollector;  // Matches recorded during the search
+ResultCollector<StampRecord> stampCollector;   // Directory stamps when recordDirectoryStamps is set
+std::vector<MatchRecord> searchResults;  // Merged matches, sorted by path
+
+/**
+ * Output stage for real-time results. Workers push records onto a lock-free
+ * MPSC list; a single writer thread takes the whole list at once, formats the
+ * batch into a large buffer and writes it when the buffer is full or the oldest
+ * unwritten line has waited long enough, instead of one flush per match.
+ */
+class ConsoleWriter {
+public:
+    /**
+     * Starts the writer thread; colors follow rang's decision for std::cout
+     */
+    void start() {
+#ifdef _WIN32
+        // Native console colors cannot be buffered, only ANSI sequences
+        const bool ansi = rang::rang_implementation::supportsAnsi(std::cout.rdbuf());
+#else
+        const bool ansi = true;
+#endif
+        const rang::control option = rang::rang_implementation::controlMode();
+        useColor = option == rang::control::Force || (option == rang::control::Auto && ansi &&
+            rang::rang_implementation::supportsColor() &&
+            rang::rang_implementation::isTerminal(std::cout.rdbuf()));
+
+        stopping = false;
+        buffer.reserve(kFlushBytes * 2);
+        writer = std::thread([this]() { writerLoop(); });
+    }
+
+    /**
+     * Queues a record for printing; never blocks
+     */
+    void push(MatchRecord record) {
+        Node* node = new Node{ nullptr, std::move(record) };
+        node->next = head.load(std::memory_order_relaxed);
+        while (!head.compare_exchange_weak(node->next, node,
+            std::memory_order_release, std::memory_order_relaxed)) {
+        }
+    }
+
+    /**
+     * Writes everything still queued and stops the writer thread
+     */
+    void stop() {
+        if (!writer.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            stopping = true;
+        }
+        wakeCV.notify_one();
+        writer.join();
+    }
+
+private:
+    struct Node {
+        Node* next;
+        MatchRecord record;
+    };
+
+    void format(const MatchRecord& record) {
+        if (!batchQueries.empty()) {
+            buffer += '[';
+            buffer += batchQueries[record.query];
+            buffer += "] ";
+        }
+        buffer += record.isDirectory ? "Found directory " : "Found ";
+        if (useColor) {
+            buffer += "\033[32m\033[1m";
+            buffer.append(record.name());
+            buffer += "\033[0m\033[39m";
+        }
+        else {
+            buffer.append(record.name());
+        }
+        buffer += " at: ";
+        buffer += record.path;
+        buffer += '\n';
+    }
+
+    void flush() {
+        if (!buffer.empty()) {
+            std::cout.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            std::cout.flush();
+            buffer.clear();
+        }
+    }
+
+    void writerLoop() {
+        auto pendingSince = std::chrono::steady_clock::now();
+
+        while (true) {
+            Node* batch = head.exchange(nullptr, std::memory_order_acquire);
+            if (batch) {
+                // The list is newest first: reverse it to print in arrival order
+                Node* ordered = nullptr;
+                while (batch) {
+                    Node* next = batch->next;
+                    batch->next = ordered;
+                    ordered = batch;
+                    batch = next;
+                }
+
+                if (buffer.empty()) {
+                    pendingSince = std::chrono::steady_clock::now();
+                }
+                while (ordered) {
+                    Node* next = ordered->next;
+                    format(ordered->record);
+                    delete ordered;
+                    ordered = next;
+                    if (buffer.size() >= kFlushBytes) {
+                        flush();
+                        pendingSince = std::chrono::steady_clock::now();
+                    }
+                }
+                continue;
+            }
+
+            if (!buffer.empty() && std::chrono::steady_clock::now() - pendingSince >= kFlushInterval) {
+                flush();
+            }
+
+            // Producers never notify, so poll for new records at a short interval
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            if (stopping) {
+                if (head.load(std::memory_order_acquire) == nullptr) {
+                    break;
+                }
+                continue;
+            }
+            wakeCV.wait_for(lock, kPollInterval);
+        }
+        flush();
+    }
+
+    static constexpr size_t kFlushBytes = 256 * 1024;
+    static constexpr std::chrono::milliseconds kFlushInterval{ 50 };
+    static constexpr std::chrono::milliseconds kPollInterval{ 5 };
+
+    std::atomic<Node*> head{ nullptr };
+    std::string buffer;
+    bool useColor = false;
+    std::thread writer;
+    std::mutex wakeMutex;
+    std::condition_variable wakeCV;      // Signals stop to an idle writer
+    bool stopping = false;
+};
+
+ConsoleWriter consoleWriter;             // Prints results during the search
+
+/**
+ * Fixed-size pool of traversal workers with work stealing.
+ * Each worker owns a deque of pending directories: it pushes and pops at the back
+ * of its own deque (depth-first, cache friendly) and steals from the front of the
+ * other deques (the oldest, usually largest subtrees) when it runs out of work.
+ * After cancel() new directories are dropped and queued ones are popped without
+ * being visited, so run() returns as soon as the visits in progress finish.
+ */
+template <typename Task>
+class TraversalPool {
+public:
+    using Visitor = std::function<void(const Task&)>;
+
+    /**
+     * Runs the traversal starting at root on workerCount threads and returns
+     * once every queued directory has been visited
+     */
+    void run(Task root, int workerCount, Visitor visitor) {
+        workerCount = std::max(workerCount, 1);
+        visit = std::move(visitor);
+        cancelled = false;
+        queues.clear();
+        for (int i = 0; i < workerCount; i++) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+
+        submit(std::move(root));
+
+        std::vector<std::thread> workers;
+        workers.reserve(workerCount);
+        for (int i = 0; i < workerCount; i++) {
+            workers.emplace_back([this, i]() { workerLoop(i); });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        queues.clear();
+    }
+
+    /**
+     * Queues a directory on the calling worker's deque (worker 0 outside the pool)
+     */
+    void submit(Task directory) {
+        if (cancelled.load(std::memory_order_relaxed)) {
+            return;
+        }
+        size_t index = currentWorker >= 0 ? static_cast<size_t>(currentWorker) : 0;
+        pending++;
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->items.push_back(std::move(directory));
+        }
+        queued++;
+
+        // Only touch the idle mutex when somebody may actually be waiting
+        if (sleepers > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex);
+            idleCV.notify_one();
+        }
+    }
+
+    /**
+     * Stops the traversal cooperatively: pending directories are drained unvisited
+     */
+    void cancel() {
+        cancelled = true;
+    }
+
+    /**
+     * Directories waiting in the deques; a hint of how much work is already queued
+     */
+    size_t queuedCount() const {
+        return queued.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct WorkerQueue {
+        std::mutex mutex;
+        std::deque<Task> items;
+    };
+
+    bool popLocal(size_t self, Task& directory) {
+        WorkerQueue& queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.items.empty()) {
+            return false;
+        }
+        directory = std::move(queue.items.back());
+        queue.items.pop_back();
+        queued--;
+        return true;
+    }
+
+    bool steal(size_t self, Task& directory) {
+        for (size_t offset = 1; offset < queues.size(); offset++) {
+            WorkerQueue& victim = *queues[(self + offset) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.items.empty()) {
+                directory = std::move(victim.items.front());
+                victim.items.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int self) {
+        currentWorker = self;
+        size_t index = static_cast<size_t>(self);
+        Task directory;
+
+        while (true) {
+            if (popLocal(index, directory) || steal(index, directory)) {
+                if (!cancelled.load(std::memory_order_relaxed)) {
+                    visit(directory);
+                }
+                if (--pending == 0) {
+                    // Last directory finished: wake everybody so they can exit
+                    std::lock_guard<std::mutex> lock(idleMutex);
+                    idleCV.notify_all();
+                }
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(idleMutex);
+            sleepers++;
+            idleCV.wait(lock, [this] { return pending == 0 || queued > 0; });
+            sleepers--;
+            if (pending == 0) {
+                break;
+            }
+        }
+        currentWorker = -1;
+    }
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues;
+    Visitor visit;
+    std::atomic<size_t> pending{ 0 };    // Directories queued or being visited
+    std::atomic<size_t> queued{ 0 };     // Directories waiting in some deque
+    std::atomic<int> sleepers{ 0 };      // Workers blocked on idleCV
+    std::atomic<bool> cancelled{ false }; // Drop queued and new directories
+    std::mutex idleMutex;
+    std::condition_variable idleCV;      // Signals new work or traversal completion
+
+    static thread_local int currentWorker;
+};
+
+template <typename Task>
+thread_local int TraversalPool<Task>::currentWorker = -1;
+
+#ifdef __linux__
+/**
+ * Open directory descriptor shared by the queued children opened relative to it.
+ * Closed once the directory has been read and every child has been opened.
+ */
+struct DirectoryFd {
+    explicit DirectoryFd(int descriptor) : fd(descriptor) {}
+    ~DirectoryFd() { close(fd); }
+    DirectoryFd(const DirectoryFd&) = delete;
+    DirectoryFd& operator=(const DirectoryFd&) = delete;
+
+    int fd;
+};
+
+/**
+ * Absolute directory path stored in a PathArena chunk, NUL-terminated
+ */
+struct PathRef {
+    std::shared_ptr<const char[]> chunk;    // Keeps the chunk alive while referenced
+    std::string_view path;
+};
+
+/**
+ * Append-only storage for directory paths. Each worker fills its own chunk, so
+ * building a child's path is one copy and no allocation in the common case; a
+ * chunk is freed once no queued directory refers to it any more.
+ */
+class PathArena {
+public:
+    /**
+     * Stores prefix + separator + name and returns a reference to it
+     * (an empty name stores prefix unchanged)
+     */
+    static PathRef append(std::string_view prefix, std::string_view name) {
+        const bool needsSeparator = !prefix.empty() && !name.empty() && prefix.back() != '/';
+        const size_t length = prefix.size() + (needsSeparator ? 1 : 0) + name.size();
+
+        Chunk& chunk = current;
+        if (!chunk.data || chunk.used + length + 1 > chunk.capacity) {
+            chunk.capacity = std::max(kChunkSize, length + 1);
+            chunk.data = std::shared_ptr<char[]>(new char[chunk.capacity]);
+            chunk.used = 0;
+        }
+
+        char* out = chunk.data.get() + chunk.used;
+        std::copy(prefix.begin(), prefix.end(), out);
+        size_t written = prefix.size();
+        if (needsSeparator) {
+            out[written++] = '/';
+        }
+        std::copy(name.begin(), name.end(), out + written);
+        out[length] = '\0';
+        chunk.used += length + 1;
+
+        return { chunk.data, std::string_view(out, length) };
+    }
+
+private:
+    struct Chunk {
+        std::shared_ptr<char[]> data;
+        size_t capacity = 0;
+        size_t used = 0;
+    };
+
+    static constexpr size_t kChunkSize = 64 * 1024;
+    static thread_local Chunk current;
+};
+
+thread_local PathArena::Chunk PathArena::current;
+
+struct IgnoreScope;
+
+/**
+ * A directory waiting to be searched, opened with openat relative to its parent
+ */
+struct DirectoryTask {
+    std::shared_ptr<DirectoryFd> parent;    // Null for the starting directory and when opened is set
+    PathRef path;                           // Absolute path of the directory
+    size_t nameOffset;                      // Start of the last component within path
+    std::shared_ptr<DirectoryFd> opened;    // Already opened by a batched openat (io_uring backend)
+    std::shared_ptr<const IgnoreScope> ignore; // Exclusion rules from above this directory, or null
 };
+#else
+using DirectoryTask = fs::path;
+#endif
+
+TraversalPool<DirectoryTask> traversalPool; // Shared by all search workers
 
 // Forward declarations
-void launchSearch(const fs::path& directory, const std::vector<std::string>& filenamePatterns,
-    SearchMode mode, PatternType patternType);
-void searchInDirectory(const fs::path& directory, const std::vector<std::string>& filenamePatterns,
-    SearchMode mode, PatternType patternType);
+void launchSearch(DirectoryTask directory);
+class Matcher;
+void searchInDirectory(const DirectoryTask& directory, const Matcher& matcher);
 void printUsage(const char* programName);
 bool validateArguments(int argc, char* argv[], std::vector<std::string>& targetPatterns,
     std::string& startingDir, SearchMode& searchMode, PatternType& patternType);
+bool parseOptions(int argc, char* argv[], int first, std::string& startingDir);
 bool parseSearchPatterns(const std::string& input, std::vector<std::string>& patterns,
     SearchMode& mode, PatternType& patternType);
-bool matchesPatterns(const std::string& filename, const std::vector<std::string>& patterns,
-    SearchMode mode, PatternType patternType);
+void acceptMatch(MatchRecord record);
+void stripTrailingSeparators(std::string& directory);
 
 /**
  * Splits string by delimiter and returns vector of tokens
@@ -88,100 +695,318 @@ std::vector<std::string> splitString(const std::string& str, const std::string&
     return tokens;
 }
 
+// Prefix that makes a term a glob; without it *, ? and braces are plain substring characters
+constexpr std::string_view kGlobPrefix = "glob:";
+
+// Prefix that enables ! and parentheses; without it they are plain substring characters
+constexpr std::string_view kExpressionPrefix = "expr:";
+
 /**
- * Parses search patterns and determines search mode and pattern type
+ * Parsed search expression: SIMPLE, GLOB and /regex/ terms combined with &&, ||, !
  */
-bool parseSearchPatterns(const std::string& input, std::vector<std::string>& patterns,
-    SearchMode& mode, PatternType& patternType) {
-    std::string trimmedInput = input;
+struct PatternNode {
+    enum class Kind { TERM, AND, OR, NOT };
 
-    // Remove leading/trailing whitespace
-    trimmedInput.erase(0, trimmedInput.find_first_not_of(" \t"));
-    trimmedInput.erase(trimmedInput.find_last_not_of(" \t") + 1);
+    Kind kind = Kind::TERM;
+    PatternType type = PatternType::SIMPLE; // TERM only
+    std::string text;                       // TERM: substring, glob, or regex without the slashes
+    std::vector<PatternNode> children;
+};
 
-    if (trimmedInput.empty()) {
-        return false;
+/**
+ * Recursive-descent parser for search expressions; ! binds tighter than &&,
+ * which binds tighter than ||, and parentheses group. ! and parentheses are
+ * only operators when the input starts with expr:, so "(1)" and "!notes"
+ * stay substring searches. A term starting with /
+ * runs to the / that ends the term and is a regex, where && and || keep their
+ * meaning of a list of regexes (/a||b/ is /a/||/b/). Any other term is a
+ * substring running to the next && or || (or the ')' closing an open group),
+ * so names containing brackets or ! elsewhere still work as before; it is a
+ * glob instead when it starts with glob:.
+ */
+class PatternParser {
+public:
+    explicit PatternParser(const std::string& input) : text(input) {}
+
+    /**
+     * Parses the whole input, reporting syntax errors to cerr
+     */
+    bool parse(PatternNode& root) {
+        if (text.compare(0, kExpressionPrefix.size(), kExpressionPrefix) == 0) {
+            position = kExpressionPrefix.size();
+            operators = true;
+        }
+        if (!parseOr(root, 0)) {
+            return false;
+        }
+        skipSpaces();
+        if (position != text.size()) {
+            std::cerr << "Error: Unmatched ')' in search pattern\n";
+            return false;
+        }
+        if (isEmpty(root)) {
+            return false;
+        }
+        return true;
     }
 
-    // Check if pattern is regex (starts and ends with /)
-    if (trimmedInput.size() >= 2 && trimmedInput[0] == '/' && trimmedInput.back() == '/') {
-        patternType = PatternType::REGEX;
-        // Remove the slashes
-        trimmedInput = trimmedInput.substr(1, trimmedInput.size() - 2);
+private:
+    static constexpr int kMaxDepth = 256;
 
-        // Check for logical operators in regex mode
-        size_t andPos = trimmedInput.find("&&");
-        size_t orPos = trimmedInput.find("||");
+    static bool isEmpty(const PatternNode& node) {
+        return node.kind == PatternNode::Kind::TERM && node.text.empty();
+    }
 
-        if (andPos != std::string::npos && orPos != std::string::npos) {
-            std::cerr << "Error: Cannot use both && and || in regex pattern\n";
-            return false;
+    bool startsWith(size_t at, const char* token) const {
+        return text.compare(at, std::strlen(token), token) == 0;
+    }
+
+    void skipSpaces() {
+        while (position < text.size() && (text[position] == ' ' || text[position] == '\t')) {
+            position++;
         }
+    }
 
-        if (andPos != std::string::npos) {
-            mode = SearchMode::AND;
-            patterns = splitString(trimmedInput, "&&");
+    /**
+     * Whether a term may end at offset: end of input, an operator or a closing ')'
+     */
+    bool termEndsAt(size_t offset) const {
+        while (offset < text.size() && (text[offset] == ' ' || text[offset] == '\t')) {
+            offset++;
         }
-        else if (orPos != std::string::npos) {
-            mode = SearchMode::OR;
-            patterns = splitString(trimmedInput, "||");
+        return offset == text.size() || startsWith(offset, "&&") || startsWith(offset, "||") ||
+            (text[offset] == ')' && openGroups > 0);
+    }
+
+    /**
+     * Combines operands with kind, dropping empty ones (a trailing || is ignored)
+     */
+    static void combine(PatternNode::Kind kind, std::vector<PatternNode>& operands, PatternNode& node) {
+        std::vector<PatternNode> kept;
+        for (auto& operand : operands) {
+            if (isEmpty(operand)) {
+                continue;
+            }
+            if (operand.kind == kind) {
+                for (auto& child : operand.children) {
+                    kept.push_back(std::move(child));
+                }
+            }
+            else {
+                kept.push_back(std::move(operand));
+            }
         }
-        else {
-            mode = SearchMode::SINGLE;
-            patterns.push_back(trimmedInput);
+
+        if (kept.size() == 1) {
+            node = std::move(kept.front());
+            return;
+        }
+        node = PatternNode();
+        if (!kept.empty()) {
+            node.kind = kind;
+            node.children = std::move(kept);
         }
     }
-    else {
-        // Simple pattern mode
-        patternType = PatternType::SIMPLE;
 
-        // Check for logical operators
-        size_t andPos = trimmedInput.find("&&");
-        size_t orPos = trimmedInput.find("||");
+    bool parseOr(PatternNode& node, int depth) {
+        std::vector<PatternNode> operands(1);
+        if (!parseAnd(operands.back(), depth)) {
+            return false;
+        }
+        while (skipSpaces(), startsWith(position, "||")) {
+            position += 2;
+            operands.emplace_back();
+            if (!parseAnd(operands.back(), depth)) {
+                return false;
+            }
+        }
+        combine(PatternNode::Kind::OR, operands, node);
+        return true;
+    }
 
-        if (andPos != std::string::npos && orPos != std::string::npos) {
-            std::cerr << "Error: Cannot use both && and || in the same search pattern\n";
+    bool parseAnd(PatternNode& node, int depth) {
+        std::vector<PatternNode> operands(1);
+        if (!parseUnary(operands.back(), depth)) {
             return false;
         }
+        while (skipSpaces(), startsWith(position, "&&")) {
+            position += 2;
+            operands.emplace_back();
+            if (!parseUnary(operands.back(), depth)) {
+                return false;
+            }
+        }
+        combine(PatternNode::Kind::AND, operands, node);
+        return true;
+    }
 
-        if (andPos != std::string::npos) {
-            mode = SearchMode::AND;
-            patterns = splitString(trimmedInput, "&&");
+    bool parseUnary(PatternNode& node, int depth) {
+        skipSpaces();
+        if (depth >= kMaxDepth) {
+            std::cerr << "Error: Search pattern is nested too deeply\n";
+            return false;
         }
-        else if (orPos != std::string::npos) {
-            mode = SearchMode::OR;
-            patterns = splitString(trimmedInput, "||");
+        if (operators && position < text.size() && text[position] == '!') {
+            position++;
+            node = PatternNode();
+            node.kind = PatternNode::Kind::NOT;
+            node.children.emplace_back();
+            if (!parseUnary(node.children.back(), depth + 1)) {
+                return false;
+            }
+            if (isEmpty(node.children.back())) {
+                std::cerr << "Error: Missing pattern after '!'\n";
+                return false;
+            }
+            return true;
         }
-        else {
-            mode = SearchMode::SINGLE;
-            patterns.push_back(trimmedInput);
+        if (operators && position < text.size() && text[position] == '(') {
+            position++;
+            openGroups++;
+            if (!parseOr(node, depth + 1)) {
+                return false;
+            }
+            skipSpaces();
+            if (position >= text.size() || text[position] != ')') {
+                std::cerr << "Error: Missing ')' in search pattern\n";
+                return false;
+            }
+            position++;
+            openGroups--;
+            return true;
         }
+        return parseTerm(node);
     }
 
-    // Remove whitespace from each pattern
-    for (auto& pattern : patterns) {
-        pattern.erase(0, pattern.find_first_not_of(" \t"));
-        pattern.erase(pattern.find_last_not_of(" \t") + 1);
+    bool parseTerm(PatternNode& node) {
+        node = PatternNode();
+        if (position < text.size() && text[position] == '/') {
+            for (size_t end = position + 1; end < text.size(); end++) {
+                if (text[end] == '\\') {
+                    end++;
+                }
+                else if (text[end] == '/' && termEndsAt(end + 1)) {
+                    std::string body = text.substr(position + 1, end - position - 1);
+                    position = end + 1;
+                    return parseRegexList(body, node);
+                }
+            }
+        }
+
+        // Substring term (also a lone / or one that is never closed)
+        size_t start = position;
+        while (position < text.size() && !startsWith(position, "&&") && !startsWith(position, "||") &&
+            !(text[position] == ')' && openGroups > 0)) {
+            position++;
+        }
+        node.text = text.substr(start, position - start);
+        node.text.erase(0, node.text.find_first_not_of(" \t"));
+        node.text.erase(node.text.find_last_not_of(" \t") + 1);
+        if (node.text.compare(0, kGlobPrefix.size(), kGlobPrefix) == 0) {
+            node.text.erase(0, kGlobPrefix.size());
+            node.type = PatternType::GLOB;
+        }
+        return true;
     }
 
-    // Remove empty patterns
-    patterns.erase(std::remove_if(patterns.begin(), patterns.end(),
-        [](const std::string& s) { return s.empty(); }), patterns.end());
+    /**
+     * Splits the body of /.../ into a regex list joined by && or ||
+     */
+    static bool parseRegexList(const std::string& body, PatternNode& node) {
+        bool hasAnd = body.find("&&") != std::string::npos;
+        bool hasOr = body.find("||") != std::string::npos;
+        if (hasAnd && hasOr) {
+            std::cerr << "Error: Cannot use both && and || in regex pattern\n";
+            return false;
+        }
 
-    if (patterns.empty()) {
-        return false;
+        std::vector<PatternNode> operands;
+        for (auto& pattern : hasAnd || hasOr ? splitString(body, hasAnd ? "&&" : "||") : std::vector<std::string>{ body }) {
+            pattern.erase(0, pattern.find_first_not_of(" \t"));
+            pattern.erase(pattern.find_last_not_of(" \t") + 1);
+            PatternNode term;
+            term.type = PatternType::REGEX;
+            term.text = pattern;
+            operands.push_back(std::move(term));
+        }
+        combine(hasAnd ? PatternNode::Kind::AND : PatternNode::Kind::OR, operands, node);
+        return true;
     }
 
-    return true;
-}
+    const std::string& text;
+    size_t position = 0;
+    int openGroups = 0;
+    bool operators = false;              // expr: given, so ! and ( ) are operators
+};
 
 /**
- * Validates command line arguments and extracts parameters
+ * Parses a search expression into a tree, reporting syntax errors to cerr
  */
-bool validateArguments(int argc, char* argv[], std::vector<std::string>& targetPatterns,
-    std::string& startingDir, SearchMode& searchMode, PatternType& patternType) {
+bool parsePatternExpression(const std::string& input, PatternNode& root) {
+    return PatternParser(input).parse(root);
+}
 
-    if (argc < 2) {
+/**
+ * Whether the tree holds any term of the given type
+ */
+bool containsType(const PatternNode& node, PatternType type) {
+    if (node.kind == PatternNode::Kind::TERM) {
+        return node.type == type;
+    }
+    return std::any_of(node.children.begin(), node.children.end(), [type](const PatternNode& child) {
+        return containsType(child, type);
+        });
+}
+
+/**
+ * Parses search patterns and determines search mode and pattern type.
+ * A single term or a list of same-type terms joined by one operator keeps the
+ * SINGLE/AND/OR modes and their specialised matchers; anything else (mixed
+ * operators, !, parentheses, terms of different types) becomes one
+ * EXPRESSION pattern holding the input, which the Matcher compiles to a plan.
+ */
+bool parseSearchPatterns(const std::string& input, std::vector<std::string>& patterns,
+    SearchMode& mode, PatternType& patternType) {
+    PatternNode root;
+    if (!parsePatternExpression(input, root)) {
+        return false;
+    }
+
+    patterns.clear();
+    if (root.kind == PatternNode::Kind::TERM) {
+        mode = SearchMode::SINGLE;
+        patternType = root.type;
+        patterns.push_back(root.text);
+        return true;
+    }
+
+    bool flat = root.kind != PatternNode::Kind::NOT;
+    for (const auto& child : root.children) {
+        flat = flat && child.kind == PatternNode::Kind::TERM && child.type == root.children.front().type;
+    }
+    if (flat) {
+        mode = root.kind == PatternNode::Kind::AND ? SearchMode::AND : SearchMode::OR;
+        patternType = root.children.front().type;
+        for (const auto& child : root.children) {
+            patterns.push_back(child.text);
+        }
+        return true;
+    }
+
+    mode = SearchMode::EXPRESSION;
+    patternType = containsType(root, PatternType::REGEX) ? PatternType::REGEX
+        : containsType(root, PatternType::GLOB) ? PatternType::GLOB : PatternType::SIMPLE;
+    patterns.push_back(input);
+    return true;
+}
+
+/**
+ * Validates command line arguments and extracts parameters
+ */
+bool validateArguments(int argc, char* argv[], std::vector<std::string>& targetPatterns,
+    std::string& startingDir, SearchMode& searchMode, PatternType& patternType) {
+
+    if (argc < 2) {
         return false; // Interactive mode
     }
 
@@ -199,7 +1024,24 @@ bool validateArguments(int argc, char* argv[], std::vector<std::string>& targetP
     }
 
     // Parse other options
-    for (int i = 2; i < argc; ) {
+    if (!parseOptions(argc, argv, 2, startingDir)) {
+        return false;
+    }
+
+    if (targetPatterns.empty()) {
+        std::cerr << "Error: No target filename patterns specified!\n";
+        printUsage(argv[0]);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Parses the options that follow the pattern (or the --index subcommand)
+ */
+bool parseOptions(int argc, char* argv[], int first, std::string& startingDir) {
+    for (int i = first; i < argc; ) {
         std::string arg = argv[i];
 
         if (arg == "--help") {
@@ -234,258 +1076,5884 @@ bool validateArguments(int argc, char* argv[], std::vector<std::string>& targetP
             startingDir = argv[++i];
             i++;
         }
-        else if (arg == "--save") {
-            if (i + 1 >= argc || argv[i + 1][0] == '-') {
-                std::cerr << "Error: --save requires a filename argument\n";
-                return false;
+        else if (arg == "--save") {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                std::cerr << "Error: --save requires a filename argument\n";
+                return false;
+            }
+            saveFilename = argv[++i];
+            i++;
+        }
+        else if (arg == "--noverbose") {
+            printDuringSearch = false;
+            i++;
+        }
+        else if (arg == "--searchdir") {
+            searchDirectories = true;
+            i++;
+        }
+        else if (arg == "--max-results") {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                std::cerr << "Error: --max-results requires a numeric argument\n";
+                return false;
+            }
+            try {
+                long long count = std::stoll(argv[++i]);
+                if (count <= 0) {
+                    std::cerr << "Error: --max-results must be at least 1\n";
+                    return false;
+                }
+                maxResults = static_cast<size_t>(count);
+            }
+            catch (...) {
+                std::cerr << "Error: Invalid number for --max-results\n";
+                return false;
+            }
+            i++;
+        }
+        else if (arg == "--contains") {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                std::cerr << "Error: --contains requires a pattern argument\n";
+                return false;
+            }
+            contentPattern = argv[++i];
+            i++;
+        }
+        else if (arg == "--size" || arg == "--mtime" || arg == "--newer") {
+            // Values may start with '-' (smaller, newer), so only a missing one is an error
+            if (i + 1 >= argc) {
+                std::cerr << "Error: " << arg << " requires a value\n";
+                return false;
+            }
+            metadataOptions.emplace_back(arg, argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--exclude") {
+            if (i + 1 >= argc) {
+                std::cerr << "Error: --exclude requires a pattern argument\n";
+                return false;
+            }
+            excludePatterns.push_back(argv[i + 1]);
+            i += 2;
+        }
+        else if (arg == "--xdev") {
+            sameFileSystem = true;
+            i++;
+        }
+        else if (arg == "--skip-fstype" || arg.rfind("--skip-fstype=", 0) == 0) {
+            std::string types;
+            if (arg == "--skip-fstype") {
+                if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                    std::cerr << "Error: --skip-fstype requires a comma-separated list of types\n";
+                    return false;
+                }
+                types = argv[++i];
+            }
+            else {
+                types = arg.substr(std::strlen("--skip-fstype="));
+            }
+            std::istringstream list(types);
+            std::string type;
+            while (std::getline(list, type, ',')) {
+                if (!type.empty()) {
+                    skipFileSystemTypes.push_back(type);
+                }
+            }
+            i++;
+        }
+        else if (arg == "--ignore-files") {
+            useIgnoreFiles = true;
+            i++;
+        }
+        else if (arg == "--first") {
+            maxResults = 1;
+            i++;
+        }
+        else if (arg == "--io-backend" || arg.rfind("--io-backend=", 0) == 0) {
+            std::string backend;
+            if (arg == "--io-backend") {
+                if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                    std::cerr << "Error: --io-backend requires uring or sync\n";
+                    return false;
+                }
+                backend = argv[++i];
+            }
+            else {
+                backend = arg.substr(std::strlen("--io-backend="));
+            }
+            if (backend == "uring") {
+                ioBackend = IoBackend::URING;
+            }
+            else if (backend == "sync") {
+                ioBackend = IoBackend::SYNC;
+            }
+            else {
+                std::cerr << "Error: Unknown I/O backend: " << backend << " (expected uring or sync)\n";
+                return false;
+            }
+            i++;
+        }
+        else if (arg == "--split") {
+            splitSaveByQuery = true;
+            i++;
+        }
+        else if (arg == "--db") {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                std::cerr << "Error: --db requires an index filename argument\n";
+                return false;
+            }
+            indexFilename = argv[++i];
+            i++;
+        }
+        else if (arg == "--socket") {
+            if (i + 1 >= argc || argv[i + 1][0] == '-') {
+                std::cerr << "Error: --socket requires a socket path argument\n";
+                return false;
+            }
+            socketFilename = argv[++i];
+            i++;
+        }
+        else {
+            std::cerr << "Error: Unknown option: " << arg << "\n";
+            printUsage(argv[0]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Validates "--index build|update [options]" and "--index query <pattern> [options]"
+ */
+bool validateIndexArguments(int argc, char* argv[], RunMode& command,
+    std::vector<std::string>& targetPatterns, std::string& startingDir,
+    SearchMode& searchMode, PatternType& patternType) {
+    if (argc < 3) {
+        std::cerr << "Error: --index requires 'build', 'update' or 'query'\n";
+        return false;
+    }
+
+    std::string subcommand = argv[2];
+    if (subcommand == "build") {
+        command = RunMode::INDEX_BUILD;
+        return parseOptions(argc, argv, 3, startingDir);
+    }
+    if (subcommand == "update") {
+        command = RunMode::INDEX_UPDATE;
+        return parseOptions(argc, argv, 3, startingDir);
+    }
+    if (subcommand == "query") {
+        command = RunMode::INDEX_QUERY;
+        if (argc < 4 || !parseSearchPatterns(argv[3], targetPatterns, searchMode, patternType)) {
+            std::cerr << "Error: --index query requires a search pattern\n";
+            return false;
+        }
+        return parseOptions(argc, argv, 4, startingDir);
+    }
+
+    std::cerr << "Error: Unknown --index command: " << subcommand << "\n";
+    return false;
+}
+
+/**
+ * Validates "--queries <file> [options]", reading one query per line of file.
+ * Blank lines and lines starting with # are skipped.
+ */
+bool validateQueriesArguments(int argc, char* argv[], std::string& startingDir) {
+    if (argc < 3) {
+        std::cerr << "Error: --queries requires a filename argument\n";
+        return false;
+    }
+
+    std::ifstream input(argv[2]);
+    if (!input.is_open()) {
+        std::cerr << "Error: Failed to open queries file '" << argv[2] << "'!\n";
+        return false;
+    }
+
+    std::string line;
+    for (size_t lineNumber = 1; std::getline(input, line); lineNumber++) {
+        line.erase(0, line.find_first_not_of(" \t"));
+        line.erase(line.find_last_not_of(" \t\r") + 1);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> patterns;
+        SearchMode mode;
+        PatternType type;
+        if (!parseSearchPatterns(line, patterns, mode, type)) {
+            std::cerr << "Error: Invalid search pattern on line " << lineNumber << " of '" << argv[2] << "'\n";
+            return false;
+        }
+        batchQueries.push_back(line);
+    }
+    if (batchQueries.empty()) {
+        std::cerr << "Error: No queries in '" << argv[2] << "'\n";
+        return false;
+    }
+
+    return parseOptions(argc, argv, 3, startingDir);
+}
+
+/**
+ * Validates "--daemon [options]" and "--client <pattern> [options]"
+ */
+bool validateDaemonArguments(int argc, char* argv[], RunMode& command, std::string& rawPattern,
+    std::vector<std::string>& targetPatterns, std::string& startingDir,
+    SearchMode& searchMode, PatternType& patternType) {
+    if (std::string(argv[1]) == "--daemon") {
+        command = RunMode::DAEMON;
+        return parseOptions(argc, argv, 2, startingDir);
+    }
+
+    command = RunMode::CLIENT;
+    if (argc < 3 || !parseSearchPatterns(argv[2], targetPatterns, searchMode, patternType)) {
+        std::cerr << "Error: --client requires a search pattern\n";
+        return false;
+    }
+    rawPattern = argv[2];
+    return parseOptions(argc, argv, 3, startingDir);
+}
+
+/**
+ * Displays program usage information
+ */
+void printUsage(const char* programName) {
+    std::cout << "Usage: " << programName << " <pattern> [options]\n";
+    std::cout << "   or: " << programName << " --index build|update [options]\n";
+    std::cout << "   or: " << programName << " --index query <pattern> [options]\n";
+    std::cout << "   or: " << programName << " --daemon --dir <directory> [options]\n";
+    std::cout << "   or: " << programName << " --client <pattern> [options]\n";
+    std::cout << "   or: " << programName << " --queries <file> [options]\n";
+    std::cout << "   or: " << programName << " (for interactive mode)\n\n";
+    std::cout << "Patterns can include:\n";
+    std::cout << "  Simple patterns:            hello&&.exe (case-insensitive substring search)\n";
+    std::cout << "  Regular expressions (regex): /hello.*\\.exe/ (wrap regex in /.../)\n";
+    std::cout << "  Globs (whole name):         glob:*.tar.gz, glob:report_??.csv, glob:{a,b}*.log\n";
+    std::cout << "Important: In regex patterns, escape special characters properly:\n";
+    std::cout << "  - \\. for literal dot (not any character)\n";
+    std::cout << "  - \\\\ for literal backslash\n";
+    std::cout << "  - Use double backslashes in command line: /.*\\.txt/\n";
+    std::cout << "Logical operators:\n";
+    std::cout << "  pattern1&&pattern2    Find files matching ALL patterns (AND)\n";
+    std::cout << "  pattern1||pattern2    Find files matching ANY pattern (OR)\n";
+    std::cout << "  expr:!pattern         Find files NOT matching the pattern\n";
+    std::cout << "  expr:(a||b)&&!/regex/ Combine terms and /regex/ terms; ! binds tightest, then &&, then ||\n";
+    std::cout << "  pattern               Find files matching single pattern\n\n";
+    std::cout << "Examples:\n";
+    std::cout << "  " << programName << " \"hello&&.exe\"          Find files with 'hello' AND '.exe' in name\n";
+    std::cout << "  " << programName << " \"hello||.exe\"          Find files with 'hello' OR '.exe' in name\n";
+    std::cout << "  " << programName << " \"glob:*.tar.gz||glob:*.tgz\"  Find gzipped tarballs (glob)\n";
+    std::cout << "  " << programName << " \"expr:(log||tmp)&&!.gz\"  Find files with 'log' or 'tmp' but not '.gz'\n";
+    std::cout << "  " << programName << " \"/.*\\.(txt|md)/\"      Find all .txt and .md files (regex)\n";
+    std::cout << "  " << programName << " \"/XYZ_.+\\.bin/\"      Find files starting with XYZ_ and ending with .bin\n";
+    std::cout << "  " << programName << " \"/test[0-9]+\\.exe/\"  Find files like test1.exe, test42.exe (regex)\n";
+    std::cout << "  " << programName << " \"document\" --dir C:\\Users\n";
+    std::cout << "  " << programName << " --index build --dir /data --db data.idx\n";
+    std::cout << "  " << programName << " --index update --db data.idx\n";
+    std::cout << "  " << programName << " --client \".lock||.pid\"           Query a running --daemon\n";
+    std::cout << "  " << programName << " --queries rules.txt --save out.txt --split  One walk, out.<n>.txt per line\n";
+    std::cout << "  " << programName << " --index query \"report||.csv\" --db data.idx\n\n";
+    std::cout << "Options:\n";
+    std::cout << "  --threads <num>        Number of threads to use (1-"
+        << std::thread::hardware_concurrency() << ", default: all cores)\n";
+    std::cout << "  --dir <directory>      Starting directory (default: current directory)\n";
+    std::cout << "  --save <filename>      Save results to specified file\n";
+    std::cout << "  --noverbose            Do not print results during search\n";
+    std::cout << "  --searchdir            Include directory names in search\n";
+    std::cout << "  --contains <pattern>   Only report files whose content contains <pattern> (or /regex/ on a line)\n";
+    std::cout << "  --size [+|-]<n>[kMGT]  Only report entries larger (+), smaller (-) or exactly this size\n";
+    std::cout << "  --mtime [+|-]<n>[unit] Modified more (+) or less (-) than <n> s/m/h/d/w ago (default: days)\n";
+    std::cout << "  --newer <file>         Only report entries modified after <file>\n";
+    std::cout << "  --max-results <num>    Stop the search after <num> matches\n";
+    std::cout << "  --first                Stop at the first match (same as --max-results 1)\n";
+    std::cout << "  --split                With --queries and --save, save each query to <name>.<n><ext>\n";
+    std::cout << "  --exclude <pattern>    Skip entries matching a .gitignore-style pattern; excluded directories are pruned\n";
+    std::cout << "  --ignore-files         Also honor .gitignore and .qfsignore files (and skip .git directories)\n";
+    std::cout << "  --xdev                 Do not descend into other mounted file systems\n";
+    std::cout << "  --skip-fstype <types>  Do not enter mounts of these types, e.g. nfs,nfs4,fuse (pseudo ones always)\n";
+    std::cout << "  --io-backend <name>    Directory I/O: sync (default) or uring to batch stat/open calls (Linux)\n";
+    std::cout << "  --db <filename>        Index file for --index build/query (default: qfs.idx)\n";
+    std::cout << "  --socket <path>        Socket for --daemon/--client (default: $XDG_RUNTIME_DIR/qfs.sock)\n";
+    std::cout << "  --help                 Show this help message\n";
+}
+
+/**
+ * Converts string to lowercase for case-insensitive comparison (simple mode)
+ */
+std::string toLower(const std::string& str) {
+    std::string result = str;
+    std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+}
+
+/**
+ * ASCII-only case folding, matching toLower in the default "C" locale
+ */
+inline unsigned char foldAscii(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? static_cast<unsigned char>(c + ('a' - 'A')) : c;
+}
+
+inline unsigned char upperAscii(unsigned char c) {
+    return (c >= 'a' && c <= 'z') ? static_cast<unsigned char>(c - ('a' - 'A')) : c;
+}
+
+/**
+ * Compares text against an already lowercased needle, folding text on the fly
+ */
+inline bool equalsCaseless(const char* text, const char* lowerNeedle, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        if (foldAscii(static_cast<unsigned char>(text[i])) != static_cast<unsigned char>(lowerNeedle[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Scalar case-insensitive substring search starting at offset start.
+ * Also used by the vector kernels for the tail that does not fill a register.
+ */
+bool containsCaselessScalar(const char* text, size_t textLength,
+    const char* lowerNeedle, size_t needleLength, size_t start = 0) {
+    if (needleLength == 0) {
+        return true;
+    }
+    if (needleLength > textLength) {
+        return false;
+    }
+
+    const unsigned char first = static_cast<unsigned char>(lowerNeedle[0]);
+    for (size_t i = start; i + needleLength <= textLength; i++) {
+        if (foldAscii(static_cast<unsigned char>(text[i])) == first &&
+            equalsCaseless(text + i + 1, lowerNeedle + 1, needleLength - 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+#ifdef QFS_X86_64
+inline unsigned countTrailingZeros(uint32_t mask) {
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return static_cast<unsigned>(index);
+#else
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define QFS_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define QFS_TARGET_AVX2
+#endif
+
+/**
+ * SSE2 kernel: compares 16 positions at a time against the first and last needle
+ * bytes (both cases) and only verifies the middle of candidates that hit both
+ */
+bool containsCaselessSse2(const char* text, size_t textLength,
+    const char* lowerNeedle, size_t needleLength) {
+    if (needleLength == 0) {
+        return true;
+    }
+    if (needleLength > textLength) {
+        return false;
+    }
+
+    const unsigned char first = static_cast<unsigned char>(lowerNeedle[0]);
+    const unsigned char last = static_cast<unsigned char>(lowerNeedle[needleLength - 1]);
+    const __m128i firstLower = _mm_set1_epi8(static_cast<char>(first));
+    const __m128i firstUpper = _mm_set1_epi8(static_cast<char>(upperAscii(first)));
+    const __m128i lastLower = _mm_set1_epi8(static_cast<char>(last));
+    const __m128i lastUpper = _mm_set1_epi8(static_cast<char>(upperAscii(last)));
+
+    size_t i = 0;
+    for (; i + needleLength - 1 + 16 <= textLength; i += 16) {
+        const __m128i blockFirst = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i));
+        const __m128i blockLast = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + i + needleLength - 1));
+        const __m128i matchFirst = _mm_or_si128(_mm_cmpeq_epi8(blockFirst, firstLower),
+            _mm_cmpeq_epi8(blockFirst, firstUpper));
+        const __m128i matchLast = _mm_or_si128(_mm_cmpeq_epi8(blockLast, lastLower),
+            _mm_cmpeq_epi8(blockLast, lastUpper));
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_and_si128(matchFirst, matchLast)));
+        while (mask != 0) {
+            const size_t offset = i + countTrailingZeros(mask);
+            if (needleLength <= 2 || equalsCaseless(text + offset + 1, lowerNeedle + 1, needleLength - 2)) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return containsCaselessScalar(text, textLength, lowerNeedle, needleLength, i);
+}
+
+/**
+ * AVX2 kernel: same first/last byte filter as the SSE2 kernel over 32 positions
+ */
+QFS_TARGET_AVX2
+bool containsCaselessAvx2(const char* text, size_t textLength,
+    const char* lowerNeedle, size_t needleLength) {
+    if (needleLength == 0) {
+        return true;
+    }
+    if (needleLength > textLength) {
+        return false;
+    }
+
+    const unsigned char first = static_cast<unsigned char>(lowerNeedle[0]);
+    const unsigned char last = static_cast<unsigned char>(lowerNeedle[needleLength - 1]);
+    const __m256i firstLower = _mm256_set1_epi8(static_cast<char>(first));
+    const __m256i firstUpper = _mm256_set1_epi8(static_cast<char>(upperAscii(first)));
+    const __m256i lastLower = _mm256_set1_epi8(static_cast<char>(last));
+    const __m256i lastUpper = _mm256_set1_epi8(static_cast<char>(upperAscii(last)));
+
+    size_t i = 0;
+    for (; i + needleLength - 1 + 32 <= textLength; i += 32) {
+        const __m256i blockFirst = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i));
+        const __m256i blockLast = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(text + i + needleLength - 1));
+        const __m256i matchFirst = _mm256_or_si256(_mm256_cmpeq_epi8(blockFirst, firstLower),
+            _mm256_cmpeq_epi8(blockFirst, firstUpper));
+        const __m256i matchLast = _mm256_or_si256(_mm256_cmpeq_epi8(blockLast, lastLower),
+            _mm256_cmpeq_epi8(blockLast, lastUpper));
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_and_si256(matchFirst, matchLast)));
+        while (mask != 0) {
+            const size_t offset = i + countTrailingZeros(mask);
+            if (needleLength <= 2 || equalsCaseless(text + offset + 1, lowerNeedle + 1, needleLength - 2)) {
+                return true;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return containsCaselessScalar(text, textLength, lowerNeedle, needleLength, i);
+}
+
+bool cpuSupportsAvx2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    const bool osxsave = (info[2] & (1 << 27)) != 0;
+    const bool avx = (info[2] & (1 << 28)) != 0;
+    if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif // QFS_X86_64
+
+using ContainsCaselessFn = bool (*)(const char*, size_t, const char*, size_t);
+
+/**
+ * Picks the widest substring kernel the CPU supports
+ */
+ContainsCaselessFn selectContainsCaseless() {
+#ifdef QFS_X86_64
+    if (cpuSupportsAvx2()) {
+        return containsCaselessAvx2;
+    }
+    return containsCaselessSse2;
+#else
+    return [](const char* text, size_t textLength, const char* lowerNeedle, size_t needleLength) {
+        return containsCaselessScalar(text, textLength, lowerNeedle, needleLength);
+        };
+#endif
+}
+
+// Case-insensitive substring kernel, chosen once at startup
+const ContainsCaselessFn containsCaseless = selectContainsCaseless();
+
+/**
+ * Extracts literal runs that every name matching an ECMAScript regex must
+ * contain, lowercased and longest first. Only top-level concatenation is
+ * analysed: groups, classes, wildcards and anchors end a run, an optional
+ * atom (?, *, {0,...}) is dropped from it, and a repeated atom (+, {n,...})
+ * ends it. A top-level alternation yields no literals, since no single
+ * factor is then required.
+ */
+std::vector<std::string> extractRequiredLiterals(const std::string& pattern) {
+    std::vector<std::string> literals;
+    std::string run;
+    auto endRun = [&]() {
+        if (!run.empty()) {
+            literals.push_back(run);
+            run.clear();
+        }
+        };
+
+    int depth = 0;
+    bool inClass = false;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        char c = pattern[i];
+        bool literal = false;
+        char value = c;
+        bool atom = true;        // Whether a following quantifier applies to this item
+
+        if (inClass) {
+            if (c == '\\') {
+                i++;
+            }
+            else if (c == ']') {
+                inClass = false;
+            }
+            continue;
+        }
+        if (c == '\\' && i + 1 < pattern.size()) {
+            char escaped = pattern[++i];
+            if (!std::isalnum(static_cast<unsigned char>(escaped))) {
+                literal = true;
+                value = escaped;
+            }
+            else if (escaped == 'n' || escaped == 't' || escaped == 'r') {
+                literal = true;
+                value = escaped == 'n' ? '\n' : escaped == 't' ? '\t' : '\r';
+            }
+            else if (escaped == 'b' || escaped == 'B') {
+                atom = false;
+            }
+            else if (escaped == 'x' || escaped == 'u' || escaped == 'c') {
+                return {}; // Code escapes are not decoded here
+            }
+        }
+        else if (c == '(') {
+            depth++;
+            atom = false;
+        }
+        else if (c == ')') {
+            depth--;
+        }
+        else if (c == '[') {
+            inClass = true;
+        }
+        else if (c == '{') {
+            // Counted repeat of a group, class or wildcard: skip its bounds
+            size_t close = pattern.find('}', i);
+            if (close == std::string::npos) {
+                return {};
+            }
+            i = close;
+            endRun();
+            continue;
+        }
+        else if (c == '|') {
+            if (depth == 0) {
+                return {};
+            }
+        }
+        else if (c == '^' || c == '$') {
+            atom = false;
+        }
+        else if (c != '.' && c != '*' && c != '+' && c != '?' && c != '{' && c != '}') {
+            literal = true;
+        }
+
+        // Literals inside groups are not tracked; the group as a whole breaks the run
+        if (depth > 0 || (c == ')' && depth == 0)) {
+            endRun();
+            continue;
+        }
+        if (!atom) {
+            endRun();
+            continue;
+        }
+
+        // Consume the quantifier following this item, if any
+        size_t next = i + 1;
+        bool optional = false;
+        bool repeated = false;
+        if (next < pattern.size() && (pattern[next] == '*' || pattern[next] == '?')) {
+            optional = true;
+            i = next;
+        }
+        else if (next < pattern.size() && pattern[next] == '+') {
+            repeated = true;
+            i = next;
+        }
+        else if (next < pattern.size() && pattern[next] == '{') {
+            size_t close = pattern.find('}', next);
+            if (close == std::string::npos) {
+                return {};
+            }
+            std::string bounds = pattern.substr(next + 1, close - next - 1);
+            if (bounds.empty() || !std::isdigit(static_cast<unsigned char>(bounds[0]))) {
+                return {};
+            }
+            unsigned long minimum = std::strtoul(bounds.c_str(), nullptr, 10);
+            optional = minimum == 0;
+            repeated = bounds != "1" && bounds != "1,1";
+            i = close;
+        }
+        if (i >= next && i + 1 < pattern.size() && pattern[i + 1] == '?') {
+            i++; // Lazy quantifier
+        }
+        if (i >= next && i + 1 < pattern.size() &&
+            (pattern[i + 1] == '*' || pattern[i + 1] == '+' || pattern[i + 1] == '?' || pattern[i + 1] == '{')) {
+            optional = true; // A stacked quantifier may make the atom optional
+        }
+
+        if (!literal || optional) {
+            endRun();
+            continue;
+        }
+        run += static_cast<char>(foldAscii(static_cast<unsigned char>(value)));
+        if (repeated) {
+            endRun();
+        }
+    }
+    endRun();
+
+    std::sort(literals.begin(), literals.end(), [](const std::string& a, const std::string& b) {
+        return a.size() > b.size();
+        });
+    return literals;
+}
+
+/**
+ * Case-folded Aho-Corasick automaton over a set of lowercased needles.
+ * Scans a name once and reports which needles occur in it, so OR ("any bit")
+ * and AND ("all bits") over hundreds of needles cost one pass instead of one
+ * substring search per needle. Input bytes are mapped to equivalence classes
+ * (one per distinct needle byte plus "other") to keep the transition table small.
+ */
+class NeedleAutomaton {
+public:
+    /**
+     * Builds the automaton; duplicate needles are merged
+     */
+    void build(const std::vector<std::string>& lowerNeedles) {
+        std::vector<std::string> unique = lowerNeedles;
+        std::sort(unique.begin(), unique.end());
+        unique.erase(std::unique(unique.begin(), unique.end()), unique.end());
+        needleCount = unique.size();
+
+        // Byte classes: 0 is "not in any needle", upper and lower case share a class
+        std::fill(std::begin(byteClass), std::end(byteClass), static_cast<uint8_t>(0));
+        classCount = 1;
+        for (const auto& needle : unique) {
+            for (unsigned char c : needle) {
+                if (byteClass[c] == 0) {
+                    byteClass[c] = static_cast<uint8_t>(classCount);
+                    byteClass[upperAscii(c)] = static_cast<uint8_t>(classCount);
+                    classCount++;
+                }
+            }
+        }
+
+        // Trie
+        transitions.assign(classCount, -1);
+        outputNeedle.assign(1, -1);
+        for (size_t id = 0; id < unique.size(); id++) {
+            int32_t state = 0;
+            for (unsigned char c : unique[id]) {
+                int32_t& next = transitions[state * classCount + byteClass[c]];
+                if (next < 0) {
+                    next = static_cast<int32_t>(outputNeedle.size());
+                    outputNeedle.push_back(-1);
+                    transitions.resize(transitions.size() + classCount, -1);
+                }
+                state = transitions[state * classCount + byteClass[c]];
+            }
+            outputNeedle[state] = static_cast<int32_t>(id);
+        }
+
+        // Breadth-first pass turns the trie into a full DFA and links each state
+        // to the nearest suffix state that ends a needle
+        const size_t stateCount = outputNeedle.size();
+        std::vector<int32_t> failure(stateCount, 0);
+        firstOutput.assign(stateCount, -1);
+        outputLink.assign(stateCount, -1);
+        std::deque<int32_t> queue;
+
+        for (size_t cls = 0; cls < classCount; cls++) {
+            int32_t& next = transitions[cls];
+            if (next < 0) {
+                next = 0;
+            }
+            else {
+                queue.push_back(next);
+            }
+        }
+
+        while (!queue.empty()) {
+            int32_t state = queue.front();
+            queue.pop_front();
+
+            int32_t fail = failure[state];
+            outputLink[state] = outputNeedle[fail] >= 0 ? fail : outputLink[fail];
+            firstOutput[state] = outputNeedle[state] >= 0 ? state : outputLink[state];
+
+            for (size_t cls = 0; cls < classCount; cls++) {
+                int32_t& next = transitions[state * classCount + cls];
+                if (next < 0) {
+                    next = transitions[fail * classCount + cls];
+                }
+                else {
+                    failure[next] = transitions[fail * classCount + cls];
+                    queue.push_back(next);
+                }
+            }
+        }
+    }
+
+    size_t size() const {
+        return needleCount;
+    }
+
+    /**
+     * Scans text once, setting bit i of matched for every needle i found.
+     * Returns the number of distinct needles found; stops early when stopAtFirst is set
+     */
+    size_t scan(const char* text, size_t length, std::vector<uint64_t>& matched, bool stopAtFirst) const {
+        matched.assign((needleCount + 63) / 64, 0);
+        size_t found = 0;
+        int32_t state = 0;
+
+        for (size_t i = 0; i < length; i++) {
+            state = transitions[state * classCount + byteClass[static_cast<unsigned char>(text[i])]];
+            for (int32_t out = firstOutput[state]; out >= 0; out = outputLink[out]) {
+                size_t id = static_cast<size_t>(outputNeedle[out]);
+                uint64_t bit = uint64_t(1) << (id % 64);
+                if ((matched[id / 64] & bit) == 0) {
+                    matched[id / 64] |= bit;
+                    if (++found == needleCount || stopAtFirst) {
+                        return found;
+                    }
+                }
+            }
+        }
+        return found;
+    }
+
+    bool matchesAny(const char* text, size_t length) const {
+        int32_t state = 0;
+        for (size_t i = 0; i < length; i++) {
+            state = transitions[state * classCount + byteClass[static_cast<unsigned char>(text[i])]];
+            if (firstOutput[state] >= 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool matchesAll(const char* text, size_t length) const {
+        thread_local std::vector<uint64_t> matched;
+        return scan(text, length, matched, false) == needleCount;
+    }
+
+private:
+    uint8_t byteClass[256] = {};
+    size_t classCount = 1;
+    size_t needleCount = 0;
+    std::vector<int32_t> transitions;    // stateCount x classCount DFA table
+    std::vector<int32_t> outputNeedle;   // Needle ending exactly at a state, or -1
+    std::vector<int32_t> firstOutput;    // First state on the suffix chain that ends a needle
+    std::vector<int32_t> outputLink;     // Next shorter suffix state that ends a needle
+};
+
+/**
+ * Set of case-insensitive ECMAScript regexes compiled into one Thompson NFA
+ * and matched against whole names with a lazily built DFA: one pass over a
+ * name tells how many of the patterns match it, so OR and AND lists of any
+ * length cost a single scan. Every name byte costs one table lookup once its
+ * state exists, matching never recurses, and time is linear in the name length
+ * whatever the patterns. DFA states are built on first use in a per-thread
+ * cache, so workers share the compiled NFA without locking.
+ * Constructs a DFA cannot express (backreferences, lookahead, word boundaries,
+ * POSIX classes, huge counted repeats) make add() return false so the caller
+ * can fall back to std::regex; syntax errors throw std::regex_error.
+ */
+class RegexSet {
+public:
+    /**
+     * Parses pattern and adds it to the set; false (and the set unchanged) if
+     * it needs features outside the DFA subset
+     */
+    bool add(const std::string& regexPattern) {
+        static std::atomic<uint64_t> nextProgramId(1);
+        const size_t stateMark = states.size();
+        const size_t setMark = byteSets.size();
+        pattern = regexPattern;
+        position = 0;
+
+        try {
+            Node root = parseDisjunction(0);
+            if (position != pattern.size()) {
+                throw std::regex_error(std::regex_constants::error_paren);
+            }
+            uint32_t match = addState(STATE_MATCH, 0, 0, 0);
+            entries.push_back(emit(root, match));
+        }
+        catch (const Unsupported&) {
+            rollback(stateMark, setMark);
+            return false;
+        }
+        catch (...) {
+            rollback(stateMark, setMark);
+            throw;
+        }
+
+        for (size_t set = setMark; set < byteSets.size(); set++) {
+            refineByteClasses(byteSets[set]);
+        }
+        programId = nextProgramId++; // Caches built for the smaller set no longer apply
+        return true;
+    }
+
+    size_t size() const {
+        return entries.size();
+    }
+
+    /**
+     * Checks whether the whole of text (std::regex_match semantics) matches any
+     * pattern of the set, or every pattern when requireAll is set
+     */
+    bool matches(std::string_view text, bool requireAll) const {
+        DfaCache& cache = threadCache();
+        const uint32_t required = requireAll ? static_cast<uint32_t>(entries.size()) : 1;
+        int32_t state = run(cache, text, required);
+        return state >= 0 && cache.accepted[state].size() >= required;
+    }
+
+    /**
+     * Returns the ids (in add order) of every pattern that matches the whole of text.
+     * The list is owned by the calling thread's cache and valid until its next call.
+     */
+    const std::vector<uint32_t>& matchingPatterns(std::string_view text) const {
+        static const std::vector<uint32_t> none;
+        DfaCache& cache = threadCache();
+        int32_t state = run(cache, text, 1);
+        return state >= 0 ? cache.accepted[state] : none;
+    }
+
+private:
+    struct Unsupported {};
+
+
+    using ByteSet = std::bitset<256>;
+
+    enum NodeKind : uint8_t { NODE_EMPTY, NODE_BYTES, NODE_CONCAT, NODE_ALTERNATE, NODE_REPEAT, NODE_BEGIN, NODE_END };
+
+    struct Node {
+        NodeKind kind = NODE_EMPTY;
+        uint32_t set = 0;        // Index into byteSets for NODE_BYTES
+        int min = 0;             // NODE_REPEAT bounds, max -1 for unbounded
+        int max = 0;
+        std::vector<Node> children;
+    };
+
+    enum StateKind : uint8_t { STATE_BYTES, STATE_SPLIT, STATE_BEGIN, STATE_END, STATE_MATCH };
+
+    struct State {
+        StateKind kind;
+        uint32_t out;            // Next state (first branch of a split)
+        uint32_t alt;            // Second branch of a split
+        uint32_t set;            // Accepted bytes of STATE_BYTES
+    };
+
+    /**
+     * DFA states discovered by one thread: each is the sorted set of NFA states
+     * (BYTES, END and MATCH only) reachable after the input consumed so far
+     */
+    struct DfaCache {
+        std::vector<int32_t> next;           // state * classCount + class, kUnknown until built
+        std::vector<std::vector<uint32_t>> accepted; // Patterns that match if the input ends here
+        std::vector<uint32_t> live;          // Patterns with NFA states left (0 for the dead state)
+        std::vector<std::vector<uint32_t>> sets;
+        std::map<std::vector<uint32_t>, int32_t> ids;
+        std::vector<uint32_t> mark;          // Closure visit marks, by generation
+        uint32_t generation = 0;
+        int32_t start = 0;
+    };
+
+    static constexpr int kMaxDepth = 256;            // Group nesting
+    static constexpr int kMaxRepeat = 1000;          // Counted repeat bound
+    static constexpr size_t kMaxNfaStates = 100000;
+    static constexpr size_t kMaxDfaStates = 10000;   // Cache is dropped beyond this
+    static constexpr int32_t kUnknown = -1;
+    static constexpr uint32_t kStartMarker = UINT32_MAX; // Keeps the start state apart from equal sets
+
+    /**
+     * Runs the DFA over text; -1 as soon as fewer than required patterns can still match
+     */
+    int32_t run(DfaCache& cache, std::string_view text, uint32_t required) const {
+        if (cache.sets.size() > kMaxDfaStates) {
+            resetCache(cache);
+        }
+
+        int32_t state = cache.start;
+        for (unsigned char c : text) {
+            const uint32_t inputClass = byteClass[c];
+            int32_t next = cache.next[static_cast<size_t>(state) * classCount + inputClass];
+            if (next == kUnknown) {
+                next = buildTransition(cache, state, inputClass);
+            }
+            if (cache.live[next] < required) {
+                return -1;
+            }
+            state = next;
+        }
+        return state;
+    }
+
+    bool atEnd() const {
+        return position >= pattern.size();
+    }
+
+    void rollback(size_t stateCount, size_t setCount) {
+        states.resize(stateCount);
+        patternOf.resize(stateCount);
+        byteSets.resize(setCount);
+    }
+
+    uint32_t addSet(const ByteSet& set) {
+        byteSets.push_back(set);
+        return static_cast<uint32_t>(byteSets.size() - 1);
+    }
+
+    /**
+     * Adds the other case of every ASCII letter in set
+     */
+    static void foldCase(ByteSet& set) {
+        for (int c = 'a'; c <= 'z'; c++) {
+            if (set[c] || set[c - 'a' + 'A']) {
+                set.set(c);
+                set.set(c - 'a' + 'A');
+            }
+        }
+    }
+
+    /**
+     * Adds the bytes of \d, \s or \w (lowercase letter) or their complements
+     */
+    static void addClassEscape(char escape, ByteSet& set) {
+        ByteSet members;
+        for (int c = 0; c < 256; c++) {
+            unsigned char byte = static_cast<unsigned char>(c);
+            switch (std::tolower(escape)) {
+            case 'd': members[c] = byte >= '0' && byte <= '9'; break;
+            case 's': members[c] = byte == ' ' || (byte >= '\t' && byte <= '\r'); break;
+            default:  members[c] = std::isalnum(byte) != 0 || byte == '_'; break;
+            }
+        }
+        set |= std::isupper(static_cast<unsigned char>(escape)) ? ~members : members;
+    }
+
+    static bool isClassEscape(char c) {
+        return c == 'd' || c == 'D' || c == 's' || c == 'S' || c == 'w' || c == 'W';
+    }
+
+    static int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        return -1;
+    }
+
+    /**
+     * Decodes a character escape after the backslash (shared by atoms and
+     * classes); class escapes and backreferences are handled by the callers
+     */
+    unsigned char parseCharacterEscape(bool inClass) {
+        char c = pattern[position++];
+        switch (c) {
+        case 'f': return '\f';
+        case 'n': return '\n';
+        case 'r': return '\r';
+        case 't': return '\t';
+        case 'v': return '\v';
+        case 'x':
+        case 'u': {
+            const size_t digits = c == 'x' ? 2 : 4;
+            int value = 0;
+            for (size_t i = 0; i < digits; i++) {
+                int digit = atEnd() ? -1 : hexValue(pattern[position]);
+                if (digit < 0) {
+                    throw std::regex_error(std::regex_constants::error_escape);
+                }
+                value = value * 16 + digit;
+                position++;
+            }
+            if (value > 0xFF) {
+                throw Unsupported();
+            }
+            return static_cast<unsigned char>(value);
+        }
+        default:
+            if (inClass && c == 'b') {
+                return '\b';
+            }
+            if (std::isalnum(static_cast<unsigned char>(c))) {
+                throw Unsupported(); // \c, \0, backreferences and unknown letter escapes
+            }
+            return static_cast<unsigned char>(c);
+        }
+    }
+
+    Node bytesNode(ByteSet set) {
+        foldCase(set);
+        Node node;
+        node.kind = NODE_BYTES;
+        node.set = addSet(set);
+        return node;
+    }
+
+    Node parseDisjunction(int depth) {
+        Node alternation;
+        alternation.kind = NODE_ALTERNATE;
+        alternation.children.push_back(parseAlternative(depth));
+        while (!atEnd() && pattern[position] == '|') {
+            position++;
+            alternation.children.push_back(parseAlternative(depth));
+        }
+        if (alternation.children.size() == 1) {
+            return std::move(alternation.children.front());
+        }
+        return alternation;
+    }
+
+    Node parseAlternative(int depth) {
+        Node sequence;
+        sequence.kind = NODE_CONCAT;
+        while (!atEnd() && pattern[position] != '|' && pattern[position] != ')') {
+            sequence.children.push_back(parseTerm(depth));
+        }
+        return sequence;
+    }
+
+    Node parseTerm(int depth) {
+        char c = pattern[position];
+        if (c == '^' || c == '$') {
+            position++;
+            Node anchor;
+            anchor.kind = c == '^' ? NODE_BEGIN : NODE_END;
+            return anchor;
+        }
+        if (c == '\\' && position + 1 < pattern.size() &&
+            (pattern[position + 1] == 'b' || pattern[position + 1] == 'B')) {
+            throw Unsupported();
+        }
+
+        // libstdc++ accepts stacked quantifiers such as a** and applies each in turn
+        Node atom = parseAtom(depth);
+        while (!atEnd() && (pattern[position] == '*' || pattern[position] == '+' ||
+            pattern[position] == '?' || pattern[position] == '{')) {
+            atom = parseQuantifier(std::move(atom));
+        }
+        return atom;
+    }
+
+    /**
+     * Wraps atom in the quantifier at the current position
+     */
+    Node parseQuantifier(Node atom) {
+        int min;
+        int max;
+        char c = pattern[position];
+        if (c == '*' || c == '+' || c == '?') {
+            position++;
+            min = c == '+' ? 1 : 0;
+            max = c == '?' ? 1 : -1;
+        }
+        else {
+            position++;
+            min = parseBound();
+            max = min;
+            if (!atEnd() && pattern[position] == ',') {
+                position++;
+                max = !atEnd() && std::isdigit(static_cast<unsigned char>(pattern[position])) ? parseBound() : -1;
+            }
+            if (atEnd() || pattern[position] != '}') {
+                throw std::regex_error(std::regex_constants::error_brace);
+            }
+            position++;
+            if (max != -1 && max < min) {
+                throw std::regex_error(std::regex_constants::error_badbrace);
+            }
+        }
+        if (!atEnd() && pattern[position] == '?') {
+            position++; // Lazy and greedy quantifiers accept the same names
+        }
+
+        Node repeat;
+        repeat.kind = NODE_REPEAT;
+        repeat.min = min;
+        repeat.max = max;
+        repeat.children.push_back(std::move(atom));
+        return repeat;
+    }
+
+    int parseBound() {
+        if (atEnd() || !std::isdigit(static_cast<unsigned char>(pattern[position]))) {
+            throw std::regex_error(std::regex_constants::error_badbrace);
+        }
+        long value = 0;
+        while (!atEnd() && std::isdigit(static_cast<unsigned char>(pattern[position]))) {
+            value = value * 10 + (pattern[position++] - '0');
+            if (value > kMaxRepeat) {
+                throw Unsupported();
+            }
+        }
+        return static_cast<int>(value);
+    }
+
+    Node parseAtom(int depth) {
+        char c = pattern[position++];
+        ByteSet set;
+        switch (c) {
+        case '.':
+            set.set();
+            set.reset('\n');
+            set.reset('\r');
+            return bytesNode(set);
+        case '(': {
+            if (depth >= kMaxDepth) {
+                throw std::regex_error(std::regex_constants::error_complexity);
+            }
+            if (!atEnd() && pattern[position] == '?') {
+                if (position + 1 >= pattern.size() || pattern[position + 1] != ':') {
+                    throw Unsupported(); // Lookahead
+                }
+                position += 2;
+            }
+            Node inner = parseDisjunction(depth + 1);
+            if (atEnd() || pattern[position] != ')') {
+                throw std::regex_error(std::regex_constants::error_paren);
+            }
+            position++;
+            return inner;
+        }
+        case '[':
+            return parseClass();
+        case '\\':
+            if (atEnd()) {
+                throw std::regex_error(std::regex_constants::error_escape);
+            }
+            if (isClassEscape(pattern[position])) {
+                addClassEscape(pattern[position++], set);
+                return bytesNode(set);
+            }
+            set.set(parseCharacterEscape(false));
+            return bytesNode(set);
+        case '*':
+        case '+':
+        case '?':
+        case '{':
+            throw std::regex_error(std::regex_constants::error_badrepeat);
+        case ']':
+        case '}':
+            throw Unsupported(); // Left to std::regex, which decides if they are literal
+        default:
+            set.set(static_cast<unsigned char>(c));
+            return bytesNode(set);
+        }
+    }
+
+    Node parseClass() {
+        ByteSet set;
+        bool negate = false;
+        if (!atEnd() && pattern[position] == '^') {
+            negate = true;
+            position++;
+        }
+        if (!atEnd() && pattern[position] == ']') {
+            throw Unsupported(); // Empty class, or a leading literal ']'
+        }
+
+        while (true) {
+            if (atEnd()) {
+                throw std::regex_error(std::regex_constants::error_brack);
+            }
+            char c = pattern[position++];
+            if (c == ']') {
+                break;
+            }
+
+            unsigned char low;
+            if (c == '[' && !atEnd() && (pattern[position] == ':' || pattern[position] == '.' || pattern[position] == '=')) {
+                throw Unsupported();
+            }
+            if (c == '\\') {
+                if (atEnd()) {
+                    throw std::regex_error(std::regex_constants::error_escape);
+                }
+                if (isClassEscape(pattern[position])) {
+                    addClassEscape(pattern[position++], set);
+                    if (!atEnd() && pattern[position] == '-' && position + 1 < pattern.size() && pattern[position + 1] != ']') {
+                        throw Unsupported(); // Range from a class escape
+                    }
+                    continue;
+                }
+                low = parseCharacterEscape(true);
+            }
+            else {
+                low = static_cast<unsigned char>(c);
+            }
+
+            unsigned char high = low;
+            if (position + 1 < pattern.size() && pattern[position] == '-' && pattern[position + 1] != ']') {
+                position++;
+                char end = pattern[position++];
+                if (end == '\\') {
+                    if (atEnd() || isClassEscape(pattern[position])) {
+                        throw Unsupported();
+                    }
+                    high = parseCharacterEscape(true);
+                }
+                else if (end == '[') {
+                    throw Unsupported();
+                }
+                else {
+                    high = static_cast<unsigned char>(end);
+                }
+                if (high < low) {
+                    throw std::regex_error(std::regex_constants::error_range);
+                }
+            }
+            for (int byte = low; byte <= high; byte++) {
+                set.set(byte);
+            }
+        }
+
+        foldCase(set);
+        if (negate) {
+            set.flip();
+        }
+        Node node;
+        node.kind = NODE_BYTES;
+        node.set = addSet(set);
+        return node;
+    }
+
+    uint32_t addState(StateKind kind, uint32_t out, uint32_t alt, uint32_t set) {
+        if (states.size() >= kMaxNfaStates) {
+            throw Unsupported();
+        }
+        states.push_back({ kind, out, alt, set });
+        patternOf.push_back(static_cast<uint32_t>(entries.size()));
+        return static_cast<uint32_t>(states.size() - 1);
+    }
+
+    /**
+     * Emits states for node so that a match continues at next; returns the entry state
+     */
+    uint32_t emit(const Node& node, uint32_t next) {
+        switch (node.kind) {
+        case NODE_EMPTY:
+            return next;
+        case NODE_BYTES:
+            return addState(STATE_BYTES, next, 0, node.set);
+        case NODE_BEGIN:
+            return addState(STATE_BEGIN, next, 0, 0);
+        case NODE_END:
+            return addState(STATE_END, next, 0, 0);
+        case NODE_CONCAT:
+            for (auto child = node.children.rbegin(); child != node.children.rend(); ++child) {
+                next = emit(*child, next);
+            }
+            return next;
+        case NODE_ALTERNATE: {
+            uint32_t entry = emit(node.children.back(), next);
+            for (size_t i = node.children.size() - 1; i-- > 0; ) {
+                uint32_t branch = emit(node.children[i], next);
+                entry = addState(STATE_SPLIT, branch, entry, 0);
+            }
+            return entry;
+        }
+        case NODE_REPEAT: {
+            const Node& body = node.children.front();
+            uint32_t tail = next;
+            if (node.max < 0) {
+                uint32_t loop = addState(STATE_SPLIT, 0, next, 0);
+                uint32_t bodyEntry = emit(body, loop);
+                states[loop].out = bodyEntry;
+                tail = loop;
+            }
+            else {
+                for (int i = node.min; i < node.max; i++) {
+                    uint32_t bodyEntry = emit(body, tail);
+                    tail = addState(STATE_SPLIT, bodyEntry, next, 0);
+                }
+            }
+            for (int i = 0; i < node.min; i++) {
+                tail = emit(body, tail);
+            }
+            return tail;
+        }
+        }
+        return next;
+    }
+
+    /**
+     * Splits the byte classes so that no class has bytes both inside and outside set
+     */
+    void refineByteClasses(const ByteSet& set) {
+        std::map<std::pair<uint8_t, bool>, uint8_t> split;
+        classRepresentative.clear();
+        for (int c = 0; c < 256; c++) {
+            auto inserted = split.emplace(std::make_pair(byteClass[c], static_cast<bool>(set[c])),
+                static_cast<uint8_t>(split.size()));
+            if (inserted.second) {
+                classRepresentative.push_back(static_cast<unsigned char>(c));
+            }
+            byteClass[c] = inserted.first->second;
+        }
+        classCount = classRepresentative.size();
+    }
+
+    DfaCache& threadCache() const {
+        thread_local std::unordered_map<uint64_t, std::unique_ptr<DfaCache>> caches;
+        std::unique_ptr<DfaCache>& cache = caches[programId];
+        if (!cache) {
+            cache = std::make_unique<DfaCache>();
+            resetCache(*cache);
+        }
+        return *cache;
+    }
+
+    void resetCache(DfaCache& cache) const {
+        cache.next.clear();
+        cache.accepted.clear();
+        cache.live.clear();
+        cache.sets.clear();
+        cache.ids.clear();
+        cache.mark.assign(states.size(), 0);
+        cache.generation = 0;
+
+        std::vector<uint32_t> initial;
+        std::vector<uint32_t> stack;
+        nextGeneration(cache);
+        for (uint32_t entry : entries) {
+            addClosure(cache, entry, true, initial, stack);
+        }
+        cache.start = stateFor(cache, std::move(initial), true);
+    }
+
+    static void nextGeneration(DfaCache& cache) {
+        if (++cache.generation == 0) {
+            std::fill(cache.mark.begin(), cache.mark.end(), 0);
+            cache.generation = 1;
+        }
+    }
+
+    /**
+     * Adds the BYTES, END and MATCH states reachable from state without input
+     */
+    void addClosure(DfaCache& cache, uint32_t state, bool atBegin,
+        std::vector<uint32_t>& set, std::vector<uint32_t>& stack) const {
+        stack.push_back(state);
+        while (!stack.empty()) {
+            uint32_t current = stack.back();
+            stack.pop_back();
+            if (cache.mark[current] == cache.generation) {
+                continue;
+            }
+            cache.mark[current] = cache.generation;
+
+            const State& nfaState = states[current];
+            if (nfaState.kind == STATE_SPLIT) {
+                stack.push_back(nfaState.alt);
+                stack.push_back(nfaState.out);
+            }
+            else if (nfaState.kind == STATE_BEGIN) {
+                if (atBegin) {
+                    stack.push_back(nfaState.out);
+                }
+            }
+            else {
+                set.push_back(current);
+            }
+        }
+    }
+
+    /**
+     * Lists the patterns whose MATCH state is reachable from set once the input has ended
+     */
+    std::vector<uint32_t> acceptedAtEnd(DfaCache& cache, const std::vector<uint32_t>& set, bool atBegin) const {
+        std::vector<uint32_t> accepted;
+        nextGeneration(cache);
+        std::vector<uint32_t> stack(set.begin(), set.end());
+        while (!stack.empty()) {
+            uint32_t current = stack.back();
+            stack.pop_back();
+            if (current >= states.size() || cache.mark[current] == cache.generation) {
+                continue;
+            }
+            cache.mark[current] = cache.generation;
+
+            const State& nfaState = states[current];
+            switch (nfaState.kind) {
+            case STATE_MATCH:
+                accepted.push_back(patternOf[current]); // One MATCH state per pattern
+                break;
+            case STATE_SPLIT:
+                stack.push_back(nfaState.alt);
+                stack.push_back(nfaState.out);
+                break;
+            case STATE_END:
+                stack.push_back(nfaState.out);
+                break;
+            case STATE_BEGIN:
+                if (atBegin) {
+                    stack.push_back(nfaState.out);
+                }
+                break;
+            default:
+                break;
+            }
+        }
+        std::sort(accepted.begin(), accepted.end());
+        return accepted;
+    }
+
+    /**
+     * Counts the patterns that still have an NFA state in set
+     */
+    uint32_t livePatterns(const std::vector<uint32_t>& set) const {
+        std::vector<uint32_t> patterns;
+        for (uint32_t current : set) {
+            if (current < states.size()) {
+                patterns.push_back(patternOf[current]);
+            }
+        }
+        std::sort(patterns.begin(), patterns.end());
+        return static_cast<uint32_t>(std::unique(patterns.begin(), patterns.end()) - patterns.begin());
+    }
+
+    /**
+     * Finds or creates the DFA state for a set of NFA states
+     */
+    int32_t stateFor(DfaCache& cache, std::vector<uint32_t> set, bool isStart) const {
+        std::sort(set.begin(), set.end());
+        if (isStart) {
+            set.push_back(kStartMarker);
+        }
+        auto found = cache.ids.find(set);
+        if (found != cache.ids.end()) {
+            return found->second;
+        }
+
+        int32_t id = static_cast<int32_t>(cache.sets.size());
+        cache.accepted.push_back(acceptedAtEnd(cache, set, isStart));
+        cache.live.push_back(livePatterns(set));
+        cache.next.resize(cache.next.size() + classCount, kUnknown);
+        cache.ids.emplace(set, id);
+        cache.sets.push_back(std::move(set));
+        return id;
+    }
+
+    int32_t buildTransition(DfaCache& cache, int32_t from, uint32_t inputClass) const {
+        const unsigned char byte = classRepresentative[inputClass];
+        std::vector<uint32_t> set;
+        std::vector<uint32_t> stack;
+        nextGeneration(cache);
+        for (uint32_t current : cache.sets[from]) {
+            if (current < states.size() && states[current].kind == STATE_BYTES &&
+                byteSets[states[current].set][byte]) {
+                addClosure(cache, states[current].out, false, set, stack);
+            }
+        }
+        int32_t to = stateFor(cache, std::move(set), false);
+        cache.next[static_cast<size_t>(from) * classCount + inputClass] = to;
+        return to;
+    }
+
+    // Parser state, only used during compile
+    std::string pattern;
+    size_t position = 0;
+
+    std::vector<ByteSet> byteSets;
+    std::vector<State> states;           // The NFA of all patterns
+    std::vector<uint32_t> patternOf;     // Pattern each NFA state belongs to
+    std::vector<uint32_t> entries;       // Entry state of each pattern
+    uint8_t byteClass[256] = {};
+    std::vector<unsigned char> classRepresentative = { 0 };
+    size_t classCount = 1;
+    uint64_t programId = 0;              // Key of this program's per-thread DFA cache
+};
+
+/**
+ * A shell glob matched against whole names, case-insensitively: * matches any
+ * run of bytes, ? one byte, [abc], [a-z] and [!x] (or [^x]) one byte of a set,
+ * {a,b} expands to alternatives and \ quotes the next character.
+ * Each alternative is split at its stars into segments of fixed width: the
+ * first is checked at the start of the name, the last at its end, and the ones
+ * between are found left to right, so matching never backtracks. A segment
+ * without ?/[...] is compared as a literal: with memcmp when it has no letters
+ * (*.tar.gz, *.7z), with one folding pass otherwise, and with the SIMD
+ * substring kernel when it is the last of the middle segments (*report*).
+ */
+class GlobPattern {
+public:
+    /**
+     * Compiles glob; returns false (reporting to cerr) if its braces expand too far.
+     * Names match ASCII case-insensitively unless caseSensitive is set.
+     */
+    bool compile(const std::string& glob, bool caseSensitive = false) {
+        alternatives.clear();
+        byteSets.clear();
+        exactCase = caseSensitive;
+        std::vector<std::string> expanded;
+        if (!expandBraces(glob, expanded)) {
+            std::cerr << "Error: Glob pattern '" << glob << "' expands to more than "
+                << kMaxAlternatives << " alternatives\n";
+            return false;
+        }
+        std::sort(expanded.begin(), expanded.end());
+        expanded.erase(std::unique(expanded.begin(), expanded.end()), expanded.end());
+        for (const auto& text : expanded) {
+            alternatives.push_back(compileAlternative(text));
+        }
+        return true;
+    }
+
+    bool matches(std::string_view name) const {
+        for (const auto& alternative : alternatives) {
+            if (matchesAlternative(alternative, name)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Longest literal every match contains (lowercased unless the glob is
+     * case-sensitive), or "" if there is none
+     * (or the braces give several alternatives)
+     */
+    std::string requiredLiteral() const {
+        std::string longest;
+        if (alternatives.size() != 1) {
+            return longest;
+        }
+        for (const auto& segment : alternatives.front().segments) {
+            std::string run;
+            for (size_t i = 0; i <= segment.atoms.size(); i++) {
+                if (i < segment.atoms.size() && segment.atoms[i] == -1) {
+                    run += segment.text[i];
+                    continue;
+                }
+                if (run.size() > longest.size()) {
+                    longest = run;
+                }
+                run.clear();
+            }
+        }
+        return longest;
+    }
+
+private:
+    static constexpr size_t kMaxAlternatives = 1024;
+
+    /**
+     * Fixed-width piece between two stars. atoms[i] is -1 for the literal
+     * text[i] (lowercased unless exactCase), -2 for ?, or the index of a byte set.
+     */
+    struct Segment {
+        std::string text;
+        std::vector<int32_t> atoms;
+        bool literal = true;             // Only literal atoms
+        bool hasLetters = false;         // Literal needs case folding
+    };
+
+    struct Alternative {
+        std::vector<Segment> segments;   // Split at stars; first/last may be empty
+        bool hasStar = false;            // Otherwise segments holds the whole name
+        size_t minLength = 0;
+    };
+
+    /**
+     * Index of the } closing the brace group at open if it holds a top-level
+     * comma, else npos (a lone {x} stays literal, as in the shell)
+     */
+    static size_t braceGroupEnd(const std::string& text, size_t open) {
+        int depth = 0;
+        bool comma = false;
+        for (size_t i = open; i < text.size(); i++) {
+            if (text[i] == '\\') {
+                i++;
+            }
+            else if (text[i] == '{') {
+                depth++;
+            }
+            else if (text[i] == ',' && depth == 1) {
+                comma = true;
+            }
+            else if (text[i] == '}' && --depth == 0) {
+                return comma ? i : std::string::npos;
+            }
+        }
+        return std::string::npos;
+    }
+
+    /**
+     * Expands the first brace group with a comma and recurses on each result
+     */
+    static bool expandBraces(const std::string& text, std::vector<std::string>& out) {
+        for (size_t open = 0; open < text.size(); open++) {
+            if (text[open] == '\\') {
+                open++;
+                continue;
+            }
+            size_t close = text[open] == '{' ? braceGroupEnd(text, open) : std::string::npos;
+            if (close == std::string::npos) {
+                continue;
+            }
+
+            const std::string prefix = text.substr(0, open);
+            const std::string suffix = text.substr(close + 1);
+            int depth = 0;
+            size_t start = open + 1;
+            for (size_t i = open + 1; i <= close; i++) {
+                if (text[i] == '\\') {
+                    i++;
+                }
+                else if (text[i] == '{') {
+                    depth++;
+                }
+                else if (text[i] == '}' && depth > 0) {
+                    depth--;
+                }
+                else if ((text[i] == ',' && depth == 0) || i == close) {
+                    if (!expandBraces(prefix + text.substr(start, i - start) + suffix, out)) {
+                        return false;
+                    }
+                    start = i + 1;
+                }
+            }
+            return true;
+        }
+
+        out.push_back(text);
+        return out.size() <= kMaxAlternatives;
+    }
+
+    void addLiteral(Segment& segment, unsigned char c) const {
+        segment.text += static_cast<char>(exactCase ? c : foldAscii(c));
+        segment.atoms.push_back(-1);
+        segment.hasLetters = segment.hasLetters || (!exactCase && foldAscii(c) != upperAscii(c));
+    }
+
+    /**
+     * Parses [...] at text[position] into a byte set (folded unless exactCase);
+     * returns false if it is not closed, so the [ is taken literally
+     */
+    bool parseByteSet(const std::string& text, size_t& position, Segment& segment) {
+        size_t i = position + 1;
+        const bool negated = i < text.size() && (text[i] == '!' || text[i] == '^');
+        if (negated) {
+            i++;
+        }
+
+        std::bitset<256> bits;
+        bool first = true;
+        for (; i < text.size() && (text[i] != ']' || first); first = false) {
+            unsigned char low = static_cast<unsigned char>(text[i] == '\\' && i + 1 < text.size() ? text[++i] : text[i]);
+            i++;
+            unsigned char high = low;
+            if (i + 1 < text.size() && text[i] == '-' && text[i + 1] != ']') {
+                high = static_cast<unsigned char>(text[i + 1] == '\\' && i + 2 < text.size() ? text[i + 2] : text[i + 1]);
+                i += text[i + 1] == '\\' && i + 2 < text.size() ? 3 : 2;
+            }
+            for (unsigned c = low; c <= high; c++) {
+                bits.set(c);
+                if (!exactCase) {
+                    bits.set(foldAscii(static_cast<unsigned char>(c)));
+                    bits.set(upperAscii(static_cast<unsigned char>(c)));
+                }
+            }
+        }
+        if (i >= text.size()) {
+            return false;
+        }
+
+        if (negated) {
+            bits.flip();
+        }
+        position = i;
+        segment.atoms.push_back(static_cast<int32_t>(byteSets.size()));
+        segment.text += '\0';
+        segment.literal = false;
+        byteSets.push_back(bits);
+        return true;
+    }
+
+    Alternative compileAlternative(const std::string& text) {
+        Alternative alternative;
+        alternative.segments.emplace_back();
+        for (size_t i = 0; i < text.size(); i++) {
+            Segment& segment = alternative.segments.back();
+            const unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c == '*') {
+                alternative.hasStar = true;
+                if (!segment.atoms.empty() || alternative.segments.size() == 1) {
+                    alternative.segments.emplace_back();
+                }
+            }
+            else if (c == '?') {
+                segment.text += '\0';
+                segment.atoms.push_back(-2);
+                segment.literal = false;
+            }
+            else if (c == '[' && parseByteSet(text, i, segment)) {
+                continue;
+            }
+            else if (c == '\\' && i + 1 < text.size()) {
+                addLiteral(segment, static_cast<unsigned char>(text[++i]));
+            }
+            else {
+                addLiteral(segment, c);
+            }
+        }
+        for (const auto& segment : alternative.segments) {
+            alternative.minLength += segment.atoms.size();
+        }
+        return alternative;
+    }
+
+    /**
+     * Whether segment matches name at offset; the caller checks the length
+     */
+    bool segmentAt(const Segment& segment, const char* name) const {
+        const size_t length = segment.atoms.size();
+        if (segment.literal) {
+            return segment.hasLetters ? equalsCaseless(name, segment.text.data(), length)
+                : std::memcmp(name, segment.text.data(), length) == 0;
+        }
+        for (size_t i = 0; i < length; i++) {
+            const int32_t atom = segment.atoms[i];
+            const unsigned char c = static_cast<unsigned char>(name[i]);
+            if (atom == -1 ? (exactCase ? c : foldAscii(c)) != static_cast<unsigned char>(segment.text[i])
+                : atom >= 0 && !byteSets[atom].test(c)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool matchesAlternative(const Alternative& alternative, std::string_view name) const {
+        if (name.size() < alternative.minLength) {
+            return false;
+        }
+        const Segment& head = alternative.segments.front();
+        if (!alternative.hasStar) {
+            return name.size() == head.atoms.size() && segmentAt(head, name.data());
+        }
+
+        const Segment& tail = alternative.segments.back();
+        const size_t tailStart = name.size() - tail.atoms.size();
+        if (!segmentAt(head, name.data()) || !segmentAt(tail, name.data() + tailStart)) {
+            return false;
+        }
+
+        // Middle segments, leftmost first between the head and the tail
+        size_t position = head.atoms.size();
+        const size_t last = alternative.segments.size() - 1;
+        for (size_t s = 1; s < last; s++) {
+            const Segment& segment = alternative.segments[s];
+            const size_t width = segment.atoms.size();
+            if (s + 1 == last && segment.literal) {
+                if (exactCase) {
+                    return name.substr(position, tailStart - position).find(segment.text) != std::string_view::npos;
+                }
+                return containsCaseless(name.data() + position, tailStart - position, segment.text.data(), width);
+            }
+            while (position + width <= tailStart && !segmentAt(segment, name.data() + position)) {
+                position++;
+            }
+            if (position + width > tailStart) {
+                return false;
+            }
+            position += width;
+        }
+        return true;
+    }
+
+    std::vector<Alternative> alternatives;
+    std::vector<std::bitset<256>> byteSets;
+    bool exactCase = false;              // Compiled with caseSensitive
+};
+
+// Below this many needles, running the SIMD kernel per needle is cheaper than the automaton
+constexpr size_t kAutomatonMinNeedles = 4;
+
+/**
+ * Search patterns compiled once and shared read-only by all workers.
+ * Simple needles are stored lowercased and regexes are compiled up front (into
+ * one lazy-DFA regex set, or std::regex for constructs it does not support),
+ * so matching a file name never allocates a pattern or compiles a regex, and
+ * an OR or AND list of regexes is decided in a single pass over the name.
+ * Each regex also keeps the literals any match must contain; names missing
+ * them are rejected with containsCaseless before a lone regex or an AND list runs.
+ * Simple matching folds the file name on the fly through containsCaseless,
+ * or scans it once with the needle automaton when there are many needles.
+ * Globs are compiled to GlobPattern and never reach a regex engine.
+ * An EXPRESSION is compiled to a plan over its distinct terms: children of
+ * every AND/OR are ordered cheapest first and evaluation short-circuits, each
+ * term is decided at most once per name, and the first simple (or regex) term
+ * that is needed decides all of them in one automaton (or regex set) pass.
+ */
+class Matcher {
+public:
+    /**
+     * Compiles patterns for the given mode and type, reporting regex syntax errors to cerr
+     */
+    bool compile(const std::vector<std::string>& patterns, SearchMode searchMode, PatternType type) {
+        reset(searchMode, type);
+
+        if (mode == SearchMode::EXPRESSION) {
+            std::vector<PatternNode> roots(1);
+            return !patterns.empty() && parsePatternExpression(patterns.front(), roots.front()) &&
+                compileExpression(roots);
+        }
+
+        if (patternType == PatternType::SIMPLE) {
+            for (const auto& pattern : patterns) {
+                needles.push_back(toLower(pattern));
+            }
+            useAutomaton = mode != SearchMode::SINGLE && needles.size() >= kAutomatonMinNeedles;
+            if (useAutomaton) {
+                automaton.build(needles);
+            }
+            return !needles.empty();
+        }
+
+        if (patternType == PatternType::GLOB) {
+            for (const auto& pattern : patterns) {
+                globs.emplace_back();
+                if (!globs.back().compile(pattern)) {
+                    return false;
+                }
+            }
+            return !globs.empty();
+        }
+
+        bool valid = true;
+        std::vector<size_t> setPatterns;
+        for (const auto& pattern : patterns) {
+            bool inSet;
+            if (!addRegex(pattern, inSet)) {
+                valid = false;
+            }
+            else if (inSet) {
+                setPatterns.push_back(regexLiterals.size() - 1);
+            }
+        }
+        if (setPatterns.size() == 1) {
+            loneSetLiterals = regexLiterals[setPatterns.front()];
+        }
+        return valid && !regexLiterals.empty();
+    }
+
+    /**
+     * Compiles one independent query per --queries line. All queries share one
+     * plan: a term used by several of them is decided once per name, all simple
+     * terms in one automaton pass and all DFA regexes in one regex set pass.
+     */
+    bool compileQueries(const std::vector<std::string>& queries) {
+        reset(SearchMode::EXPRESSION, PatternType::SIMPLE);
+        batch = true;
+        std::vector<PatternNode> roots(queries.size());
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (!parsePatternExpression(queries[i], roots[i])) {
+                return false;
+            }
+        }
+        return !roots.empty() && compileExpression(roots);
+    }
+
+    /**
+     * Whether this matcher holds --queries, to be matched with matchingQueries
+     */
+    bool isBatch() const {
+        return batch;
+    }
+
+    /**
+     * Lowercased literals for planning index lookups, combined by the returned
+     * mode: with AND every match contains each needle, with OR every match
+     * contains at least one. A needle is empty when a pattern has no literal.
+     */
+    SearchMode requiredNeedles(std::vector<std::string>& required) const {
+        required.clear();
+        if (batch) {
+            required.assign(1, std::string()); // Queries are independent: no literal is required
+            return SearchMode::OR;
+        }
+        if (mode == SearchMode::EXPRESSION) {
+            collectRequired(plans.front(), required);
+            return SearchMode::AND;
+        }
+        if (patternType == PatternType::SIMPLE) {
+            required = needles;
+            return mode;
+        }
+        if (patternType == PatternType::GLOB) {
+            for (const auto& glob : globs) {
+                required.push_back(glob.requiredLiteral());
+            }
+            return mode;
+        }
+        for (const auto& literals : regexLiterals) {
+            required.push_back(literals.empty() ? std::string() : literals.front());
+        }
+        return mode;
+    }
+
+    /**
+     * Makes the matcher accept every name (used to record a whole tree)
+     */
+    void compileMatchAll() {
+        reset(SearchMode::SINGLE, PatternType::SIMPLE);
+        needles.assign(1, std::string());
+    }
+
+    /**
+     * Checks if filename matches the compiled patterns
+     */
+    bool matches(std::string_view filename) const {
+        if (mode == SearchMode::EXPRESSION) {
+            thread_local std::vector<uint8_t> decided;
+            decided.assign(leaves.size(), LEAF_UNKNOWN);
+            return evaluate(plans.front(), filename, decided.data());
+        }
+
+        if (patternType == PatternType::SIMPLE) {
+            // Simple substring search (case-insensitive)
+            if (useAutomaton) {
+                return mode == SearchMode::AND
+                    ? automaton.matchesAll(filename.data(), filename.size())
+                    : automaton.matchesAny(filename.data(), filename.size());
+            }
+
+            if (mode == SearchMode::AND) {
+                // Match ALL patterns (AND logic)
+                for (const auto& needle : needles) {
+                    if (!containsCaseless(filename.data(), filename.size(), needle.data(), needle.size())) {
+                        return false;
+                    }
+                }
+                return true;
+            }
+
+            // OR and SINGLE - match ANY pattern
+            for (const auto& needle : needles) {
+                if (containsCaseless(filename.data(), filename.size(), needle.data(), needle.size())) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        if (patternType == PatternType::GLOB) {
+            if (mode == SearchMode::AND) {
+                return std::all_of(globs.begin(), globs.end(), [filename](const GlobPattern& glob) {
+                    return glob.matches(filename);
+                    });
+            }
+            return std::any_of(globs.begin(), globs.end(), [filename](const GlobPattern& glob) {
+                return glob.matches(filename);
+                });
+        }
+
+        // REGEX mode: one pass of the regex set decides all of its patterns
+        if (mode == SearchMode::AND) {
+            for (const auto& literals : regexLiterals) {
+                if (!containsAll(literals, filename)) {
+                    return false;
+                }
+            }
+            if (regexSet.size() > 0 && !regexSet.matches(filename, true)) {
+                return false;
+            }
+            for (const auto& fallback : fallbackRegexes) {
+                if (!std::regex_match(filename.begin(), filename.end(), fallback.regex)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        if (regexSet.size() > 0 && containsAll(loneSetLiterals, filename) && regexSet.matches(filename, false)) {
+            return true;
+        }
+        for (const auto& fallback : fallbackRegexes) {
+            if (containsAll(regexLiterals[fallback.pattern], filename) &&
+                std::regex_match(filename.begin(), filename.end(), fallback.regex)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Fills queries with the index of every --queries line filename matches
+     */
+    void matchingQueries(std::string_view filename, std::vector<uint32_t>& queries) const {
+        thread_local std::vector<uint8_t> decided;
+        decided.assign(leaves.size(), LEAF_UNKNOWN);
+        queries.clear();
+        for (uint32_t i = 0; i < plans.size(); i++) {
+            if (evaluate(plans[i], filename, decided.data())) {
+                queries.push_back(i);
+            }
+        }
+    }
+
+private:
+    void reset(SearchMode searchMode, PatternType type) {
+        mode = searchMode;
+        patternType = type;
+        needles.clear();
+        useAutomaton = false;
+        regexSet = RegexSet();
+        fallbackRegexes.clear();
+        regexLiterals.clear();
+        loneSetLiterals.clear();
+        globs.clear();
+        leaves.clear();
+        setLeaves.clear();
+        plans.clear();
+        batch = false;
+    }
+
+    /**
+     * Compiles one regex into the regex set, or std::regex if the set cannot
+     * take it, and records its required literals
+     */
+    bool addRegex(const std::string& pattern, bool& inSet) {
+        try {
+            inSet = regexSet.add(pattern);
+            if (!inSet) {
+                fallbackRegexes.push_back({ std::regex(pattern, std::regex::icase | std::regex::ECMAScript),
+                    regexLiterals.size() });
+            }
+            regexLiterals.push_back(extractRequiredLiterals(pattern));
+            return true;
+        }
+        catch (const std::regex_error& e) {
+            std::cerr << "Regex error for pattern '" << pattern << "': " << e.what() << "\n";
+            return false;
+        }
+    }
+
+    enum LeafState : uint8_t { LEAF_UNKNOWN, LEAF_FALSE, LEAF_TRUE };
+
+    /**
+     * A distinct term of an expression. Simple leaves come first and share
+     * their index with needles, then regex leaves pointing at the set or a
+     * fallback, then glob leaves.
+     */
+    struct ExpressionLeaf {
+        PatternType type;
+        bool inSet = false;              // REGEX: decided by regexSet
+        uint32_t slot = 0;               // Needle, regex set pattern, fallback or glob index
+        uint32_t literals = 0;           // REGEX: index into regexLiterals
+    };
+
+    struct PlanNode {
+        PatternNode::Kind kind = PatternNode::Kind::TERM;
+        uint32_t leaf = 0;               // TERM
+        uint32_t cost = 0;               // Relative cost, orders AND/OR children
+        std::vector<PlanNode> children;
+    };
+
+    static void collectTerms(const PatternNode& node, std::vector<std::string>& simple,
+        std::vector<std::string>& regex, std::vector<std::string>& glob) {
+        if (node.kind == PatternNode::Kind::TERM) {
+            if (node.type == PatternType::SIMPLE) {
+                simple.push_back(toLower(node.text));
+            }
+            else {
+                (node.type == PatternType::REGEX ? regex : glob).push_back(node.text);
+            }
+        }
+        for (const auto& child : node.children) {
+            collectTerms(child, simple, regex, glob);
+        }
+    }
+
+    static void sortUnique(std::vector<std::string>& terms) {
+        std::sort(terms.begin(), terms.end());
+        terms.erase(std::unique(terms.begin(), terms.end()), terms.end());
+    }
+
+    /**
+     * Compiles one plan per root over the distinct terms of all of them
+     */
+    bool compileExpression(const std::vector<PatternNode>& roots) {
+        std::vector<std::string> simpleTerms;
+        std::vector<std::string> regexTerms;
+        std::vector<std::string> globTerms;
+        for (const auto& root : roots) {
+            collectTerms(root, simpleTerms, regexTerms, globTerms);
+        }
+
+        // Sorted and unique, so needle i is also needle i of the automaton
+        sortUnique(simpleTerms);
+        needles = simpleTerms;
+        useAutomaton = needles.size() >= kAutomatonMinNeedles;
+        if (useAutomaton) {
+            automaton.build(needles);
+        }
+        for (uint32_t i = 0; i < needles.size(); i++) {
+            leaves.push_back({ PatternType::SIMPLE, false, i, 0 });
+        }
+
+        sortUnique(regexTerms);
+        for (const auto& pattern : regexTerms) {
+            bool inSet;
+            if (!addRegex(pattern, inSet)) {
+                return false;
+            }
+            ExpressionLeaf leaf = { PatternType::REGEX, inSet, 0, static_cast<uint32_t>(regexLiterals.size() - 1) };
+            if (inSet) {
+                leaf.slot = static_cast<uint32_t>(setLeaves.size());
+                setLeaves.push_back(static_cast<uint32_t>(leaves.size()));
+            }
+            else {
+                leaf.slot = static_cast<uint32_t>(fallbackRegexes.size() - 1);
+            }
+            leaves.push_back(leaf);
+        }
+
+        sortUnique(globTerms);
+        for (const auto& pattern : globTerms) {
+            globs.emplace_back();
+            if (!globs.back().compile(pattern)) {
+                return false;
+            }
+            leaves.push_back({ PatternType::GLOB, false, static_cast<uint32_t>(globs.size() - 1), 0 });
+        }
+
+        for (const auto& root : roots) {
+            plans.push_back(buildPlan(root, regexTerms, globTerms));
+        }
+        return true;
+    }
+
+    PlanNode buildPlan(const PatternNode& node, const std::vector<std::string>& regexTerms,
+        const std::vector<std::string>& globTerms) const {
+        PlanNode step;
+        step.kind = node.kind;
+        if (node.kind == PatternNode::Kind::TERM) {
+            if (node.type == PatternType::SIMPLE) {
+                step.leaf = static_cast<uint32_t>(std::lower_bound(needles.begin(), needles.end(),
+                    toLower(node.text)) - needles.begin());
+                step.cost = 1;
+            }
+            else if (node.type == PatternType::GLOB) {
+                step.leaf = static_cast<uint32_t>(needles.size() + regexTerms.size() + (std::lower_bound(
+                    globTerms.begin(), globTerms.end(), node.text) - globTerms.begin()));
+                step.cost = 2;
+            }
+            else {
+                step.leaf = static_cast<uint32_t>(needles.size() + (std::lower_bound(regexTerms.begin(),
+                    regexTerms.end(), node.text) - regexTerms.begin()));
+                step.cost = leaves[step.leaf].inSet ? 4 : 32;
+            }
+            return step;
+        }
+
+        for (const auto& child : node.children) {
+            step.children.push_back(buildPlan(child, regexTerms, globTerms));
+            step.cost += step.children.back().cost;
+        }
+        std::stable_sort(step.children.begin(), step.children.end(), [](const PlanNode& a, const PlanNode& b) {
+            return a.cost < b.cost;
+            });
+        return step;
+    }
+
+    /**
+     * Literals every match must contain: each term's own, collected through AND
+     */
+    void collectRequired(const PlanNode& node, std::vector<std::string>& required) const {
+        if (node.kind == PatternNode::Kind::TERM) {
+            const ExpressionLeaf& leaf = leaves[node.leaf];
+            if (leaf.type == PatternType::SIMPLE) {
+                required.push_back(needles[leaf.slot]);
+            }
+            else if (leaf.type == PatternType::GLOB) {
+                std::string literal = globs[leaf.slot].requiredLiteral();
+                if (!literal.empty()) {
+                    required.push_back(literal);
+                }
+            }
+            else if (!regexLiterals[leaf.literals].empty()) {
+                required.push_back(regexLiterals[leaf.literals].front());
+            }
+        }
+        else if (node.kind == PatternNode::Kind::AND) {
+            for (const auto& child : node.children) {
+                collectRequired(child, required);
+            }
+        }
+    }
+
+    bool evaluate(const PlanNode& node, std::string_view filename, uint8_t* decided) const {
+        switch (node.kind) {
+        case PatternNode::Kind::TERM:
+            return leafMatches(node.leaf, filename, decided);
+        case PatternNode::Kind::NOT:
+            return !evaluate(node.children.front(), filename, decided);
+        case PatternNode::Kind::AND:
+            for (const auto& child : node.children) {
+                if (!evaluate(child, filename, decided)) {
+                    return false;
+                }
+            }
+            return true;
+        case PatternNode::Kind::OR:
+            for (const auto& child : node.children) {
+                if (evaluate(child, filename, decided)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return false;
+    }
+
+    bool leafMatches(uint32_t index, std::string_view filename, uint8_t* decided) const {
+        if (decided[index] != LEAF_UNKNOWN) {
+            return decided[index] == LEAF_TRUE;
+        }
+
+        const ExpressionLeaf& leaf = leaves[index];
+        if (leaf.type == PatternType::SIMPLE) {
+            if (useAutomaton) {
+                // One pass decides every simple term
+                thread_local std::vector<uint64_t> found;
+                automaton.scan(filename.data(), filename.size(), found, false);
+                for (uint32_t i = 0; i < needles.size(); i++) {
+                    decided[i] = (found[i / 64] >> (i % 64)) & 1 ? LEAF_TRUE : LEAF_FALSE;
+                }
+            }
+            else {
+                const std::string& needle = needles[leaf.slot];
+                decided[index] = containsCaseless(filename.data(), filename.size(), needle.data(), needle.size())
+                    ? LEAF_TRUE : LEAF_FALSE;
+            }
+        }
+        else if (leaf.type == PatternType::GLOB) {
+            decided[index] = globs[leaf.slot].matches(filename) ? LEAF_TRUE : LEAF_FALSE;
+        }
+        else if (!containsAll(regexLiterals[leaf.literals], filename)) {
+            decided[index] = LEAF_FALSE;
+        }
+        else if (!leaf.inSet) {
+            decided[index] = std::regex_match(filename.begin(), filename.end(), fallbackRegexes[leaf.slot].regex)
+                ? LEAF_TRUE : LEAF_FALSE;
+        }
+        else if (setLeaves.size() == 1) {
+            decided[index] = regexSet.matches(filename, false) ? LEAF_TRUE : LEAF_FALSE;
+        }
+        else {
+            // One pass decides every regex term of the set
+            for (uint32_t other : setLeaves) {
+                decided[other] = LEAF_FALSE;
+            }
+            for (uint32_t pattern : regexSet.matchingPatterns(filename)) {
+                decided[setLeaves[pattern]] = LEAF_TRUE;
+            }
+        }
+        return decided[index] == LEAF_TRUE;
+    }
+
+    static bool containsAll(const std::vector<std::string>& literals, std::string_view filename) {
+        for (const auto& literal : literals) {
+            if (!containsCaseless(filename.data(), filename.size(), literal.data(), literal.size())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct FallbackRegex {
+        std::regex regex;
+        size_t pattern;                  // Index into regexLiterals
+    };
+
+    SearchMode mode = SearchMode::SINGLE;
+    PatternType patternType = PatternType::SIMPLE;
+    std::vector<std::string> needles;    // Lowercased simple patterns
+    NeedleAutomaton automaton;           // All needles at once for large OR/AND lists
+    bool useAutomaton = false;
+    RegexSet regexSet;                   // Every regex the DFA engine supports
+    std::vector<FallbackRegex> fallbackRegexes; // The others, as precompiled std::regex
+    std::vector<std::vector<std::string>> regexLiterals; // Required literals per regex, longest first
+    std::vector<std::string> loneSetLiterals; // Prefilter for an OR over a one-pattern set
+    std::vector<GlobPattern> globs;      // GLOB patterns, or an expression's glob terms
+    std::vector<ExpressionLeaf> leaves;  // EXPRESSION: distinct terms
+    std::vector<uint32_t> setLeaves;     // EXPRESSION: leaf of each regex set pattern
+    std::vector<PlanNode> plans;         // EXPRESSION: evaluation tree, one per --queries line
+    bool batch = false;                  // Compiled by compileQueries
+};
+
+/**
+ * Content pattern for --contains: a literal, matched case-insensitively with
+ * the SIMD substring kernel over the whole file, or a /regex/ matched against
+ * each line. A regex first needs its required literals somewhere in the file,
+ * then runs line by line as .*(?:regex).* on the lazy DFA (or std::regex_search
+ * for constructs the DFA does not support).
+ * Files up to kPreadLimit are read with pread into a per-thread buffer; larger
+ * ones are memory-mapped so they are scanned without copying.
+ */
+class ContentMatcher {
+public:
+    /**
+     * Compiles pattern, reporting regex syntax errors to cerr
+     */
+    bool compile(const std::string& pattern) {
+        isRegex = pattern.size() >= 2 && pattern.front() == '/' && pattern.back() == '/';
+        if (!isRegex) {
+            literal = toLower(pattern);
+            return !literal.empty();
+        }
+
+        const std::string body = pattern.substr(1, pattern.size() - 2);
+        try {
+            // Checks the syntax on its own, so wrapping it below cannot change its meaning
+            std::regex checked(body, std::regex::icase | std::regex::ECMAScript);
+            if (!regexSet.add(".*(?:" + body + ").*")) {
+                fallback = std::make_unique<std::regex>(std::move(checked));
+            }
+        }
+        catch (const std::regex_error& e) {
+            std::cerr << "Regex error for content pattern '" << body << "': " << e.what() << "\n";
+            return false;
+        }
+        literals = extractRequiredLiterals(body);
+        return true;
+    }
+
+    /**
+     * Whether the file at path contains the pattern; unreadable files do not
+     */
+    bool matchesFile(const std::string& path) const {
+#ifdef __linux__
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC | O_NOCTTY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+
+        const size_t size = static_cast<size_t>(st.st_size);
+        bool found = false;
+        if (size <= kPreadLimit) {
+            thread_local std::string buffer;
+            buffer.resize(size);
+            size_t filled = 0;
+            while (filled < size) {
+                ssize_t got = pread(fd, &buffer[filled], size - filled, static_cast<off_t>(filled));
+                if (got <= 0) {
+                    break;
+                }
+                filled += static_cast<size_t>(got);
+            }
+            found = matches(buffer.data(), filled);
+        }
+        else {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping != MAP_FAILED) {
+                madvise(mapping, size, MADV_SEQUENTIAL);
+                found = matches(static_cast<const char*>(mapping), size);
+                munmap(mapping, size);
+            }
+        }
+        close(fd);
+        return found;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            return false;
+        }
+        std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        return matches(contents.data(), contents.size());
+#endif
+    }
+
+    bool matches(const char* data, size_t size) const {
+        if (!isRegex) {
+            return containsCaseless(data, size, literal.data(), literal.size());
+        }
+        for (const auto& required : literals) {
+            if (!containsCaseless(data, size, required.data(), required.size())) {
+                return false;
+            }
+        }
+
+        const char* end = data + size;
+        for (const char* line = data; line <= end; ) {
+            const char* newline = static_cast<const char*>(std::memchr(line, '\n', static_cast<size_t>(end - line)));
+            const char* lineEnd = newline ? newline : end;
+            std::string_view text(line, static_cast<size_t>(lineEnd - line));
+            if (!text.empty() && text.back() == '\r') {
+                text.remove_suffix(1);
+            }
+            if (fallback ? std::regex_search(text.begin(), text.end(), *fallback) : regexSet.matches(text, false)) {
+                return true;
+            }
+            if (!newline) {
+                break;
+            }
+            line = newline + 1;
+        }
+        return false;
+    }
+
+private:
+    static constexpr size_t kPreadLimit = 256 * 1024;
+
+    bool isRegex = false;
+    std::string literal;                 // Lowercased literal pattern
+    RegexSet regexSet;                   // .*(?:regex).* when the DFA supports it
+    std::unique_ptr<std::regex> fallback; // Otherwise the regex itself, for regex_search
+    std::vector<std::string> literals;   // Required literals of the regex, longest first
+};
+
+/**
+ * Second pipeline stage for --contains. Name matches are queued here instead of
+ * being recorded, and a separate pool of I/O workers reads each file and records
+ * it if its content matches, so traversal workers never wait on file reads.
+ */
+class ContentSearchPool {
+public:
+    /**
+     * Starts workerCount I/O workers matching queued files against matcher
+     */
+    void start(const ContentMatcher& contentMatcher, int workerCount) {
+        matcher = &contentMatcher;
+        closing = false;
+        running = true;
+        for (int i = 0; i < std::max(workerCount, 1); i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    bool active() const {
+        return running;
+    }
+
+    /**
+     * Queues a name match for its content check; never waits on I/O
+     */
+    void submit(MatchRecord record) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(record));
+        }
+        ready.notify_one();
+    }
+
+    /**
+     * Waits until every queued file has been checked and stops the workers
+     */
+    void finish() {
+        if (!running) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            closing = true;
+        }
+        ready.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        workers.clear();
+        running = false;
+    }
+
+private:
+    void workerLoop() {
+        while (true) {
+            MatchRecord record;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [this] { return closing || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                record = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            // After --max-results is reached the rest of the queue is drained unread
+            if (!searchCancelled.load(std::memory_order_relaxed) && matcher->matchesFile(record.path)) {
+                acceptMatch(std::move(record));
+            }
+        }
+    }
+
+    const ContentMatcher* matcher = nullptr;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable ready;       // Signals a queued file or finish()
+    std::deque<MatchRecord> queue;
+    bool closing = false;
+    std::atomic<bool> running{ false };
+};
+
+ContentSearchPool contentPool;           // Checks file contents when --contains is set
+
+/**
+ * Size and modification time conditions from --size, --mtime and --newer.
+ * Each condition limits one field to a range, and all of them must hold.
+ * Entries are only checked after their name has matched, with one statx per
+ * candidate asking only for the fields the conditions use.
+ */
+class MetadataFilter {
+public:
+    /**
+     * Adds a condition for option (--size, --mtime or --newer), reporting errors to cerr
+     */
+    bool add(const std::string& option, const std::string& value) {
+        if (option == "--newer") {
+            int64_t reference;
+            if (!modificationTime(value, reference)) {
+                std::cerr << "Error: Cannot read the modification time of '" << value << "'\n";
+                return false;
+            }
+            conditions.push_back({ Field::MTIME, reference + 1, INT64_MAX });
+            return true;
+        }
+
+        const bool isSize = option == "--size";
+        char sign = 0;
+        size_t position = 0;
+        if (!value.empty() && (value[0] == '+' || value[0] == '-')) {
+            sign = value[0];
+            position = 1;
+        }
+        size_t digits = position;
+        while (digits < value.size() && std::isdigit(static_cast<unsigned char>(value[digits]))) {
+            digits++;
+        }
+        const std::string suffix = value.substr(digits);
+        const int64_t unit = isSize ? sizeUnit(suffix) : ageUnit(suffix);
+        if (digits == position || digits - position > 12 || unit == 0) {
+            std::cerr << "Error: Invalid " << option << " value '" << value << "' (e.g. "
+                << (isSize ? "+1G, -10k, 4096" : "+30, -2h, 7d") << ")\n";
+            return false;
+        }
+        const int64_t count = std::stoll(value.substr(position, digits - position));
+        const int64_t scale = isSize ? unit : unit * 1000000000LL;
+        if (count > INT64_MAX / 4 / scale) {
+            std::cerr << "Error: " << option << " value '" << value << "' is out of range\n";
+            return false;
+        }
+
+        if (isSize) {
+            const int64_t bytes = count * unit;
+            conditions.push_back(sign == '+' ? Condition{ Field::SIZE, bytes + 1, INT64_MAX }
+                : sign == '-' ? Condition{ Field::SIZE, 0, bytes - 1 }
+                : Condition{ Field::SIZE, bytes, bytes });
+            return true;
+        }
+
+        // Ages count back from now: +N is older than N units, -N newer, N between N and N+1 units old
+        const int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        const int64_t span = scale;
+        conditions.push_back(sign == '+' ? Condition{ Field::MTIME, INT64_MIN, now - count * span - 1 }
+            : sign == '-' ? Condition{ Field::MTIME, now - count * span + 1, INT64_MAX }
+            : Condition{ Field::MTIME, now - (count + 1) * span + 1, now - count * span });
+        return true;
+    }
+
+    bool active() const {
+        return !conditions.empty();
+    }
+
+    /**
+     * Whether the entry at an absolute path passes every condition
+     */
+    bool matches(const std::string& path) const {
+#ifdef __linux__
+        return matchesAt(AT_FDCWD, path.c_str());
+#else
+        std::error_code error;
+        int64_t values[2] = {};
+        if (needs(Field::SIZE)) {
+            auto size = fs::file_size(path, error);
+            if (error) {
+                return false;
+            }
+            values[static_cast<int>(Field::SIZE)] = static_cast<int64_t>(size);
+        }
+        if (needs(Field::MTIME) && !modificationTime(path, values[static_cast<int>(Field::MTIME)])) {
+            return false;
+        }
+        return check(values);
+#endif
+    }
+
+#ifdef __linux__
+    /**
+     * Whether the entry name in directoryFd passes every condition; symlinks
+     * are followed, as they are when entries are classified
+     */
+    bool matchesAt(int directoryFd, const char* name) const {
+        struct statx sx;
+        if (statx(directoryFd, name, AT_STATX_SYNC_AS_STAT, statxMask(), &sx) == 0) {
+            return matchesStatx(sx);
+        }
+        struct stat st;
+        if (errno != ENOSYS || fstatat(directoryFd, name, &st, 0) != 0) {
+            return false;
+        }
+        int64_t values[2] = {};
+        values[static_cast<int>(Field::SIZE)] = static_cast<int64_t>(st.st_size);
+        values[static_cast<int>(Field::MTIME)] = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        return check(values);
+    }
+
+    /**
+     * The statx fields the conditions read
+     */
+    unsigned statxMask() const {
+        return (needs(Field::SIZE) ? STATX_SIZE : 0) | (needs(Field::MTIME) ? STATX_MTIME : 0);
+    }
+
+    /**
+     * Whether a statx result requested with statxMask() passes every condition
+     */
+    bool matchesStatx(const struct statx& sx) const {
+        const unsigned mask = statxMask();
+        if ((sx.stx_mask & mask) != mask) {
+            return false;
+        }
+        int64_t values[2] = {};
+        values[static_cast<int>(Field::SIZE)] = static_cast<int64_t>(sx.stx_size);
+        values[static_cast<int>(Field::MTIME)] = sx.stx_mtime.tv_sec * 1000000000LL + sx.stx_mtime.tv_nsec;
+        return check(values);
+    }
+#endif
+
+private:
+    enum class Field { SIZE, MTIME };
+
+    struct Condition {
+        Field field;
+        int64_t min;                     // Inclusive bounds: bytes, or nanoseconds since the epoch
+        int64_t max;
+    };
+
+    static int64_t sizeUnit(const std::string& suffix) {
+        if (suffix.empty() || suffix == "c") {
+            return 1;
+        }
+        if (suffix.size() != 1) {
+            return 0;
+        }
+        switch (std::tolower(static_cast<unsigned char>(suffix[0]))) {
+        case 'k': return 1LL << 10;
+        case 'm': return 1LL << 20;
+        case 'g': return 1LL << 30;
+        case 't': return 1LL << 40;
+        default: return 0;
+        }
+    }
+
+    // Seconds per unit; days when no unit is given
+    static int64_t ageUnit(const std::string& suffix) {
+        if (suffix.size() > 1) {
+            return 0;
+        }
+        switch (suffix.empty() ? 'd' : suffix[0]) {
+        case 's': return 1;
+        case 'm': return 60;
+        case 'h': return 3600;
+        case 'd': return 86400;
+        case 'w': return 7 * 86400;
+        default: return 0;
+        }
+    }
+
+    static bool modificationTime(const std::string& path, int64_t& nanoseconds) {
+#ifdef __linux__
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            return false;
+        }
+        nanoseconds = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        return true;
+#else
+        std::error_code error;
+        auto modified = fs::last_write_time(path, error);
+        if (error) {
+            return false;
+        }
+        // file_time_type has its own epoch: convert through the current time on both clocks
+        auto modifiedSystem = std::chrono::system_clock::now() +
+            std::chrono::duration_cast<std::chrono::system_clock::duration>(modified - fs::file_time_type::clock::now());
+        nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            modifiedSystem.time_since_epoch()).count();
+        return true;
+#endif
+    }
+
+    bool needs(Field field) const {
+        return std::any_of(conditions.begin(), conditions.end(), [field](const Condition& condition) {
+            return condition.field == field;
+            });
+    }
+
+    bool check(const int64_t* values) const {
+        for (const auto& condition : conditions) {
+            const int64_t value = values[static_cast<int>(condition.field)];
+            if (value < condition.min || value > condition.max) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::vector<Condition> conditions;
+};
+
+MetadataFilter metadataFilter;           // --size, --mtime and --newer conditions
+
+/**
+ * Exclusion rules in .gitignore syntax, from --exclude or an ignore file.
+ * A rule without a slash matches the entry name at any depth; one with a slash
+ * is anchored to the rules' base directory and matched component by component,
+ * where ** spans any number of directories. A trailing slash restricts a rule to
+ * directories, a leading ! re-includes, and the last matching rule wins.
+ * Components use the name glob syntax but match case-sensitively, as git does
+ * with core.ignorecase=false.
+ */
+class IgnoreRules {
+public:
+    enum class Verdict {
+        NONE,       // No rule matches
+        EXCLUDE,
+        INCLUDE     // A negated rule matches last
+    };
+
+    /**
+     * Adds one rule line (blank and # lines are skipped); false if a glob is invalid
+     */
+    bool add(std::string line) {
+        while (!line.empty() && (line.back() == '\r' || line.back() == '\n' ||
+            (line.back() == ' ' && (line.size() < 2 || line[line.size() - 2] != '\\')))) {
+            line.pop_back();
+        }
+        if (line.empty() || line[0] == '#') {
+            return true;
+        }
+
+        Rule rule;
+        size_t start = 0;
+        if (line[0] == '!') {
+            rule.negated = true;
+            start = 1;
+        }
+        if (line.back() == '/') {
+            rule.directoryOnly = true;
+            line.pop_back();
+        }
+        std::string_view body(line);
+        body.remove_prefix(std::min(start, body.size()));
+        rule.anchored = body.find('/') != std::string_view::npos;
+        if (!body.empty() && body.front() == '/') {
+            body.remove_prefix(1);
+        }
+        if (body.empty()) {
+            return true;
+        }
+
+        while (true) {
+            const size_t slash = body.find('/');
+            std::string component(body.substr(0, slash));
+            Component compiled;
+            compiled.anyDepth = component == "**";
+            if (!compiled.anyDepth && !component.empty() && !compiled.glob.compile(component, true)) {
+                return false;
+            }
+            if (!component.empty()) {
+                rule.components.push_back(std::move(compiled));
+            }
+            if (slash == std::string_view::npos) {
+                break;
+            }
+            body.remove_prefix(slash + 1);
+        }
+        anchoredRules |= rule.anchored;
+        rules.push_back(std::move(rule));
+        return true;
+    }
+
+    /**
+     * Adds every line of text
+     */
+    void addLines(std::string_view text) {
+        while (!text.empty()) {
+            const size_t end = text.find('\n');
+            add(std::string(text.substr(0, end)));
+            text.remove_prefix(end == std::string_view::npos ? text.size() : end + 1);
+        }
+    }
+
+    bool empty() const {
+        return rules.empty();
+    }
+
+    /**
+     * Checks the entry name in directory, given relative to the rules' base
+     * directory ("" for the base itself)
+     */
+    Verdict check(std::string_view directory, std::string_view name, bool isDirectory) const {
+        thread_local std::vector<std::string_view> path;
+        if (anchoredRules) {
+            path.clear();
+            while (!directory.empty()) {
+                const size_t slash = directory.find('/');
+                path.push_back(directory.substr(0, slash));
+                directory.remove_prefix(slash == std::string_view::npos ? directory.size() : slash + 1);
+            }
+            path.push_back(name);
+        }
+
+        for (auto rule = rules.rbegin(); rule != rules.rend(); ++rule) {
+            if (rule->directoryOnly && !isDirectory) {
+                continue;
+            }
+            const bool matched = rule->anchored
+                ? matchComponents(rule->components, 0, path, 0)
+                : rule->components.size() == 1 && rule->components[0].matches(name);
+            if (matched) {
+                return rule->negated ? Verdict::INCLUDE : Verdict::EXCLUDE;
+            }
+        }
+        return Verdict::NONE;
+    }
+
+private:
+    struct Component {
+        GlobPattern glob;
+        bool anyDepth = false;           // **
+
+        bool matches(std::string_view name) const {
+            return anyDepth || glob.matches(name);
+        }
+    };
+
+    struct Rule {
+        std::vector<Component> components;
+        bool negated = false;
+        bool directoryOnly = false;
+        bool anchored = false;           // Contains a slash: matched from the base directory
+    };
+
+    static bool matchComponents(const std::vector<Component>& components, size_t index,
+        const std::vector<std::string_view>& path, size_t position) {
+        if (index == components.size()) {
+            return position == path.size();
+        }
+        if (components[index].anyDepth) {
+            if (index + 1 == components.size()) {
+                return position < path.size(); // A trailing ** matches everything inside, not the directory
+            }
+            for (size_t next = position; next <= path.size(); next++) {
+                if (matchComponents(components, index + 1, path, next)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+        return position < path.size() && components[index].glob.matches(path[position]) &&
+            matchComponents(components, index + 1, path, position + 1);
+    }
+
+    std::vector<Rule> rules;
+    bool anchoredRules = false;
+};
+
+/**
+ * The rules of one directory's ignore files (or of --exclude for the starting
+ * directory), chained to those of its ancestors. Rules deeper in the tree take
+ * precedence, as in git.
+ */
+struct IgnoreScope {
+    std::shared_ptr<const IgnoreScope> parent;
+    IgnoreRules rules;
+    size_t baseLength = 0;               // Length of the absolute path the rules are relative to
+
+    /**
+     * Whether the entry name in directoryPath (absolute, at or below the base) is excluded
+     */
+    bool excludes(std::string_view directoryPath, std::string_view name, bool isDirectory) const {
+        for (const IgnoreScope* scope = this; scope; scope = scope->parent.get()) {
+            std::string_view relative = directoryPath.substr(std::min(scope->baseLength, directoryPath.size()));
+            if (!relative.empty() && relative.front() == '/') {
+                relative.remove_prefix(1);
+            }
+            IgnoreRules::Verdict verdict = scope->rules.check(relative, name, isDirectory);
+            if (verdict != IgnoreRules::Verdict::NONE) {
+                return verdict == IgnoreRules::Verdict::EXCLUDE;
+            }
+        }
+        return false;
+    }
+};
+
+IgnoreRules excludeRules;                // --exclude patterns (and .git/ with --ignore-files)
+std::shared_ptr<const IgnoreScope> rootIgnoreScope; // excludeRules for the current traversal's starting directory
+constexpr const char* kIgnoreFiles[] = { ".gitignore", ".qfsignore" }; // Read in this order; later rules win
+
+/**
+ * Scope for a directory's own ignore files on top of inherited; returns inherited
+ * when the directory has none
+ */
+std::shared_ptr<const IgnoreScope> loadIgnoreScope(int directoryFd, std::string_view directoryPath,
+    std::shared_ptr<const IgnoreScope> inherited) {
+    IgnoreRules rules;
+#ifdef __linux__
+    for (const char* file : kIgnoreFiles) {
+        int fd = openat(directoryFd, file, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            continue;
+        }
+        std::string text;
+        char chunk[4096];
+        ssize_t bytes;
+        while ((bytes = read(fd, chunk, sizeof(chunk))) > 0) {
+            text.append(chunk, static_cast<size_t>(bytes));
+        }
+        close(fd);
+        rules.addLines(text);
+    }
+#else
+    (void)directoryFd;
+    for (const char* file : kIgnoreFiles) {
+        std::ifstream in(fs::path(directoryPath) / file, std::ios::binary);
+        std::stringstream text;
+        text << in.rdbuf();
+        rules.addLines(text.str());
+    }
+#endif
+    if (rules.empty()) {
+        return inherited;
+    }
+    auto scope = std::make_shared<IgnoreScope>();
+    scope->parent = std::move(inherited);
+    scope->rules = std::move(rules);
+    scope->baseLength = directoryPath.size();
+    return scope;
+}
+
+/**
+ * Mount boundaries, decided by device ID so bind mounts and symlinked paths need
+ * no special cases. With --xdev only the starting directory's file system is
+ * entered; otherwise mounts whose type is in the skip list (pseudo file systems,
+ * plus --skip-fstype) are not. The starting directory itself is always searched.
+ */
+class MountFilter {
+public:
+    /**
+     * Reads /proc/self/mountinfo once and records the devices of skipped mounts
+     * below root. With none there and no --xdev, the filter stays inactive and
+     * directories are opened without a device check.
+     */
+    void configure(const std::string& root, bool sameDevice, const std::vector<std::string>& extraTypes) {
+        xdev = false;
+        skipped.clear();
+#ifdef __linux__
+        struct stat st;
+        if (stat(root.c_str(), &st) != 0) {
+            return;
+        }
+        rootDevice = static_cast<uint64_t>(st.st_dev);
+        xdev = sameDevice;
+        char* resolved = realpath(root.c_str(), nullptr);
+        std::string base = resolved ? resolved : root;
+        std::free(resolved);
+        if (base.back() != '/') {
+            base += '/';
+        }
+
+        std::vector<std::string> types(std::begin(kPseudoFileSystems), std::end(kPseudoFileSystems));
+        types.insert(types.end(), extraTypes.begin(), extraTypes.end());
+
+        // Fields: id parent major:minor root mount-point options [optional...] - type source ...
+        std::ifstream mountInfo("/proc/self/mountinfo");
+        std::string line;
+        while (std::getline(mountInfo, line)) {
+            std::istringstream fields(line);
+            std::string id, parent, device, mountRoot, mountPoint, field;
+            fields >> id >> parent >> device >> mountRoot >> mountPoint;
+            while (fields >> field && field != "-") {
+            }
+            std::string type;
+            unsigned major = 0, minor = 0;
+            if (!(fields >> type) || std::sscanf(device.c_str(), "%u:%u", &major, &minor) != 2) {
+                continue;
+            }
+            const uint64_t mountDevice = static_cast<uint64_t>(makedev(major, minor));
+            mountPoint = unescapeMountField(mountPoint) + '/';
+            if (mountPoint.compare(0, base.size(), base) != 0) {
+                continue; // Outside the search, so it can never be reached
+            }
+            if (mountDevice != rootDevice && std::any_of(types.begin(), types.end(),
+                [&type](const std::string& skip) { return typeMatches(type, skip); })) {
+                skipped.push_back(mountDevice);
+            }
+        }
+        std::sort(skipped.begin(), skipped.end());
+        skipped.erase(std::unique(skipped.begin(), skipped.end()), skipped.end());
+#else
+        (void)root;
+        if (sameDevice || !extraTypes.empty()) {
+            std::cerr << "Warning: --xdev and --skip-fstype are only supported on Linux\n";
+        }
+#endif
+    }
+
+    bool active() const {
+        return xdev || !skipped.empty();
+    }
+
+    /**
+     * Whether a directory on device may be entered
+     */
+    bool allows(uint64_t device) const {
+        if (device == rootDevice) {
+            return true;
+        }
+        return !xdev && !std::binary_search(skipped.begin(), skipped.end(), device);
+    }
+
+#ifdef __linux__
+    /**
+     * Whether the directory name in parentFd may be entered. Checked before it is
+     * opened, from cached attributes and without triggering an automount, so a
+     * skipped network mount is never contacted; errors are left to the open.
+     */
+    bool allowsAt(int parentFd, const char* name) const {
+        struct statx sx;
+        if (statx(parentFd, name, kStatxFlags, 0, &sx) == 0) {
+            return allows(static_cast<uint64_t>(makedev(sx.stx_dev_major, sx.stx_dev_minor)));
+        }
+        struct stat st;
+        if (errno != ENOSYS || fstatat(parentFd, name, &st, AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT) != 0) {
+            return true;
+        }
+        return allows(static_cast<uint64_t>(st.st_dev));
+    }
+
+    static constexpr int kStatxFlags = AT_SYMLINK_NOFOLLOW | AT_NO_AUTOMOUNT | AT_STATX_DONT_SYNC;
+#endif
+
+private:
+    // mountinfo writes space, tab, newline and backslash in paths as \ooo octal escapes
+    static std::string unescapeMountField(const std::string& field) {
+        std::string result;
+        for (size_t i = 0; i < field.size(); i++) {
+            if (field[i] == '\\' && i + 3 < field.size() &&
+                std::all_of(field.begin() + i + 1, field.begin() + i + 4, [](char c) { return c >= '0' && c <= '7'; })) {
+                result += static_cast<char>(std::stoi(field.substr(i + 1, 3), nullptr, 8));
+                i += 3;
+            }
+            else {
+                result += field[i];
+            }
+        }
+        return result;
+    }
+
+    // "fuse" also covers its subtypes, such as "fuse.sshfs"
+    static bool typeMatches(const std::string& type, const std::string& skip) {
+        return type == skip || (type.size() > skip.size() && type.compare(0, skip.size(), skip) == 0 &&
+            type[skip.size()] == '.');
+    }
+
+    // Virtual trees that hold no user files but can be huge or block on reads
+    static constexpr const char* kPseudoFileSystems[] = {
+        "proc", "sysfs", "devtmpfs", "devpts", "cgroup", "cgroup2", "debugfs", "tracefs",
+        "securityfs", "pstore", "bpf", "configfs", "fusectl", "mqueue", "hugetlbfs",
+        "binfmt_misc", "efivarfs", "rpc_pipefs", "nsfs"
+    };
+
+    uint64_t rootDevice = 0;
+    bool xdev = false;
+    std::vector<uint64_t> skipped;       // Sorted devices of mounts with a skipped type
+};
+
+MountFilter mountFilter;                 // --xdev, --skip-fstype and the pseudo file systems
+
+#ifdef __linux__
+/**
+ * Reads directory entries with raw getdents64 into a large per-thread buffer.
+ * Entries are classified from d_type; fstatat is only called when the file system
+ * reports DT_UNKNOWN, or for symlinks, which are classified by their target.
+ * With resolveTypes off those entries come back UNRESOLVED for the caller to stat.
+ */
+class DirectoryReader {
+public:
+    enum class EntryType {
+        DIRECTORY,
+        REGULAR,
+        OTHER,
+        UNRESOLVED      // DT_UNKNOWN or a symlink, only when resolveTypes is off
+    };
+
+    struct Entry {
+        std::string_view name;
+        EntryType type;
+        bool symlink;      // Type describes the symlink's target
+    };
+
+    explicit DirectoryReader(int directoryFd, bool resolveTypes = true)
+        : fd(directoryFd), resolve(resolveTypes) {}
+
+    /**
+     * Returns the next entry other than "." and "..", or false at the end of the
+     * directory or on a read error
+     */
+    bool next(Entry& entry) {
+        while (true) {
+            if (offset >= filled) {
+                long bytes = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+                if (bytes <= 0) {
+                    return false;
+                }
+                filled = static_cast<size_t>(bytes);
+                offset = 0;
+            }
+
+            const auto* record = reinterpret_cast<const LinuxDirent64*>(buffer.data() + offset);
+            offset += record->d_reclen;
+
+            std::string_view name(record->d_name);
+            if (name == "." || name == "..") {
+                continue;
+            }
+
+            entry.name = name;
+            if (!resolve && (record->d_type == DT_LNK || record->d_type == DT_UNKNOWN)) {
+                entry.type = EntryType::UNRESOLVED;
+                entry.symlink = false;
+            }
+            else {
+                entry.type = classify(record->d_type, record->d_name, entry.symlink);
+            }
+            return true;
+        }
+    }
+
+    /**
+     * Classifies name in directoryFd with fstatat; symlinks by their target
+     */
+    static EntryType classifyAt(int directoryFd, const char* name, bool& symlink) {
+        symlink = false;
+        struct stat st;
+        if (fstatat(directoryFd, name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            return EntryType::OTHER;
+        }
+        if (S_ISLNK(st.st_mode)) {
+            symlink = true;
+            if (fstatat(directoryFd, name, &st, 0) != 0) {
+                return EntryType::OTHER;
+            }
+        }
+        return typeFromMode(st.st_mode);
+    }
+
+    static EntryType typeFromMode(mode_t mode) {
+        if (S_ISDIR(mode)) {
+            return EntryType::DIRECTORY;
+        }
+        return S_ISREG(mode) ? EntryType::REGULAR : EntryType::OTHER;
+    }
+
+private:
+    struct LinuxDirent64 {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    };
+
+    EntryType classify(unsigned char type, const char* name, bool& symlink) const {
+        symlink = false;
+        switch (type) {
+        case DT_DIR:
+            return EntryType::DIRECTORY;
+        case DT_REG:
+            return EntryType::REGULAR;
+        case DT_LNK:
+        case DT_UNKNOWN:
+            return classifyAt(fd, name, symlink);
+        default:
+            return EntryType::OTHER;
+        }
+    }
+
+    int fd;
+    bool resolve;
+    size_t offset = 0;
+    size_t filled = 0;
+
+    // Directories are read one at a time per worker, so one buffer per thread suffices
+    static thread_local std::vector<char> buffer;
+};
+
+thread_local std::vector<char> DirectoryReader::buffer(256 * 1024);
+#endif
+
+#ifdef QFS_HAVE_IO_URING
+/**
+ * Minimal io_uring ring driven with raw syscalls. A worker queues the statx and
+ * openat calls for one directory and submit() hands them to the kernel with one
+ * io_uring_enter, returning once every call has completed. Each traversal worker
+ * owns its ring, so nothing here is shared between threads.
+ */
+class UringBatch {
+public:
+    static constexpr int kNotRun = -ECANCELED; // Result of a call the ring could not submit
+
+    UringBatch() = default;
+    ~UringBatch() { release(); }
+    UringBatch(const UringBatch&) = delete;
+    UringBatch& operator=(const UringBatch&) = delete;
+
+    /**
+     * Creates and maps a ring of the given size; false when io_uring is unavailable
+     */
+    bool init(unsigned entries) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        ringFd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ringFd < 0) {
+            return false;
+        }
+
+        // Since 5.4 both rings share one mapping
+        sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (singleMap) {
+            sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+        }
+        sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+
+        sqRing = mapRing(sqRingSize, IORING_OFF_SQ_RING);
+        cqRing = singleMap ? sqRing : mapRing(cqRingSize, IORING_OFF_CQ_RING);
+        void* entriesMap = mapRing(sqesSize, IORING_OFF_SQES);
+        if (!sqRing || !cqRing || !entriesMap) {
+            if (entriesMap) {
+                munmap(entriesMap, sqesSize);
+            }
+            release();
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqRing);
+        sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sqMask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sqes = static_cast<io_uring_sqe*>(entriesMap);
+
+        char* cq = static_cast<char*>(cqRing);
+        cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        capacity = params.sq_entries;
+        return true;
+    }
+
+    /**
+     * Whether the kernel supports every operation queued here
+     */
+    bool supportsOperations() const {
+        constexpr unsigned kProbeOps = 256;
+        std::vector<char> storage(sizeof(io_uring_probe) + kProbeOps * sizeof(io_uring_probe_op), 0);
+        auto* probe = reinterpret_cast<io_uring_probe*>(storage.data());
+        if (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_PROBE, probe, kProbeOps) < 0) {
+            return false;
+        }
+        auto supported = [probe](unsigned op) {
+            return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED) != 0;
+            };
+        return supported(IORING_OP_OPENAT) && supported(IORING_OP_STATX);
+    }
+
+    /**
+     * Set after io_uring_enter failed for a reason other than an interruption
+     */
+    bool failed() const {
+        return broken;
+    }
+
+    /**
+     * Queues openat(directoryFd, name, flags); result receives the descriptor or -errno
+     */
+    void openAt(int directoryFd, const char* name, int flags, int* result) {
+        io_uring_sqe sqe;
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = directoryFd;
+        sqe.addr = reinterpret_cast<uint64_t>(name);
+        sqe.open_flags = static_cast<uint32_t>(flags);
+        push(sqe, result);
+    }
+
+    /**
+     * Queues statx(directoryFd, name, flags, mask, buffer); result receives 0 or -errno
+     */
+    void statxAt(int directoryFd, const char* name, int flags, unsigned mask, struct statx* buffer, int* result) {
+        io_uring_sqe sqe;
+        std::memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_STATX;
+        sqe.fd = directoryFd;
+        sqe.addr = reinterpret_cast<uint64_t>(name);
+        sqe.len = mask;
+        sqe.off = reinterpret_cast<uint64_t>(buffer);
+        sqe.statx_flags = static_cast<uint32_t>(flags);
+        push(sqe, result);
+    }
+
+    /**
+     * Submits the queued calls and waits until all of them have completed
+     */
+    void submit() {
+        unsigned unsubmitted = queued;
+        unsigned outstanding = queued;
+        while (outstanding > 0) {
+            long entered = syscall(__NR_io_uring_enter, ringFd, unsubmitted, outstanding,
+                IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (entered < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    continue;
+                }
+                // Take back what the kernel has not seen; those calls keep kNotRun
+                broken = true;
+                __atomic_store_n(sqTail, *sqTail - unsubmitted, __ATOMIC_RELEASE);
+                outstanding -= unsubmitted;
+                unsubmitted = 0;
+                const unsigned reaped = reap();
+                if (reaped == 0) {
+                    break;
+                }
+                outstanding -= reaped;
+                continue;
+            }
+            unsubmitted -= static_cast<unsigned>(entered);
+            outstanding -= reap();
+        }
+        queued = 0;
+    }
+
+private:
+    void* mapRing(size_t size, off_t offset) const {
+        void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd, offset);
+        return map == MAP_FAILED ? nullptr : map;
+    }
+
+    void push(const io_uring_sqe& sqe, int* result) {
+        if (queued == capacity) {
+            submit(); // Ring full: run this part of the batch first
+        }
+        *result = kNotRun;
+        if (broken) {
+            return;
+        }
+        const unsigned tail = *sqTail;
+        const unsigned index = tail & sqMask;
+        sqes[index] = sqe;
+        sqes[index].user_data = reinterpret_cast<uint64_t>(result);
+        sqArray[index] = index;
+        __atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+    }
+
+    // Copies finished results to their callers and returns how many there were
+    unsigned reap() {
+        unsigned head = *cqHead;
+        const unsigned tail = __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+        unsigned count = 0;
+        for (; head != tail; head++, count++) {
+            const io_uring_cqe& cqe = cqes[head & cqMask];
+            *reinterpret_cast<int*>(cqe.user_data) = cqe.res;
+        }
+        __atomic_store_n(cqHead, head, __ATOMIC_RELEASE);
+        return count;
+    }
+
+    void release() {
+        if (sqes) {
+            munmap(sqes, sqesSize);
+        }
+        if (cqRing && cqRing != sqRing) {
+            munmap(cqRing, cqRingSize);
+        }
+        if (sqRing) {
+            munmap(sqRing, sqRingSize);
+        }
+        if (ringFd >= 0) {
+            close(ringFd);
+        }
+        sqes = nullptr;
+        sqRing = cqRing = nullptr;
+        ringFd = -1;
+    }
+
+    int ringFd = -1;
+    void* sqRing = nullptr;
+    void* cqRing = nullptr;
+    size_t sqRingSize = 0;
+    size_t cqRingSize = 0;
+    size_t sqesSize = 0;
+    unsigned* sqTail = nullptr;
+    unsigned sqMask = 0;
+    unsigned* sqArray = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned capacity = 0;
+    unsigned queued = 0;                 // Calls pushed since the last submit()
+    bool broken = false;
+};
+
+constexpr unsigned kUringEntries = 256;  // Calls per io_uring_enter; larger batches are split
+
+/**
+ * The calling worker's ring, set up on first use; null if io_uring cannot be used,
+ * in which case the worker stays on the synchronous reader
+ */
+UringBatch* workerRing() {
+    thread_local std::unique_ptr<UringBatch> ring;
+    thread_local bool unavailable = false;
+    if (!ring && !unavailable) {
+        ring = std::make_unique<UringBatch>();
+        if (!ring->init(kUringEntries)) {
+            ring.reset();
+            unavailable = true;
+        }
+    }
+    return ring && !ring->failed() ? ring.get() : nullptr;
+}
+#endif
+
+/**
+ * Whether --io-backend uring can run here: the kernel creates rings and supports
+ * batched openat and statx
+ */
+bool ioUringAvailable() {
+#ifdef QFS_HAVE_IO_URING
+    UringBatch ring;
+    return ring.init(8) && ring.supportsOperations();
+#else
+    return false;
+#endif
+}
+
+#ifdef __linux__
+DirectoryStamp stampFromStat(const struct stat& st) {
+    DirectoryStamp stamp;
+    stamp.mtimeSeconds = static_cast<int64_t>(st.st_mtim.tv_sec);
+    stamp.mtimeNanoseconds = static_cast<int64_t>(st.st_mtim.tv_nsec);
+    stamp.inode = static_cast<uint64_t>(st.st_ino);
+    stamp.device = static_cast<uint64_t>(st.st_dev);
+    return stamp;
+}
+#endif
+
+/**
+ * Reads the stamp of a real directory without following a symlink at path
+ * (except for the starting directory). Returns false if it is gone or not a directory.
+ */
+bool statDirectory(const std::string& path, bool followSymlink, DirectoryStamp& stamp) {
+#ifdef __linux__
+    struct stat st;
+    if ((followSymlink ? stat(path.c_str(), &st) : lstat(path.c_str(), &st)) != 0 || !S_ISDIR(st.st_mode)) {
+        return false;
+    }
+    stamp = stampFromStat(st);
+    return true;
+#else
+    std::error_code error;
+    fs::file_status status = followSymlink ? fs::status(path, error) : fs::symlink_status(path, error);
+    if (error || !fs::is_directory(status)) {
+        return false;
+    }
+    auto modified = fs::last_write_time(path, error);
+    if (error) {
+        return false;
+    }
+    stamp = DirectoryStamp();
+    stamp.mtimeSeconds = static_cast<int64_t>(modified.time_since_epoch().count());
+    return true;
+#endif
+}
+
+/**
+ * Stops the search early: the traversal drains its queue, and directory,
+ * index and daemon result loops stop at their next check
+ */
+void cancelSearch() {
+    searchCancelled = true;
+    traversalPool.cancel();
+}
+
+/**
+ * Hands a match to the output stage and the result collector. With --max-results
+ * only the first maxResults matches are kept and the last one cancels the search.
+ */
+void acceptMatch(MatchRecord record) {
+    if (maxResults != 0) {
+        const size_t count = ++resultCount;
+        if (count > maxResults) {
+            return;
+        }
+        if (count == maxResults) {
+            cancelSearch();
+        }
+    }
+    if (printDuringSearch) {
+        consoleWriter.push(record);
+    }
+    resultCollector.add(std::move(record));
+}
+
+/**
+ * Reports a name match: with --contains files go to the content stage first
+ * and directories, which have no content, are dropped
+ */
+void recordMatch(MatchRecord record) {
+    if (contentPool.active()) {
+        if (!record.isDirectory) {
+            contentPool.submit(std::move(record));
+        }
+        return;
+    }
+    acceptMatch(std::move(record));
+}
+
+/**
+ * Records a matching file or directory and prints it when real-time output is on.
+ * The path is built once by appending name to the already absolute directory path.
+ */
+void reportMatch(std::string_view name, std::string_view directoryPath, bool isDirectory, uint32_t query = 0) {
+    const bool needsSeparator = !directoryPath.empty() &&
+        directoryPath.back() != '/' && directoryPath.back() != fs::path::preferred_separator;
+
+    MatchRecord record;
+    record.path.reserve(directoryPath.size() + 1 + name.size());
+    record.path.append(directoryPath);
+    if (needsSeparator) {
+        record.path += static_cast<char>(fs::path::preferred_separator);
+    }
+    record.nameOffset = static_cast<uint32_t>(record.path.size());
+    record.path.append(name);
+    record.isDirectory = isDirectory;
+    record.query = query;
+
+    recordMatch(std::move(record));
+}
+
+/**
+ * Checks the metadata conditions of an entry whose name matched; on Linux the
+ * name is looked up relative to the open directory
+ */
+inline bool passesMetadata(int directoryFd, std::string_view name, std::string_view directoryPath) {
+    if (!metadataFilter.active()) {
+        return true;
+    }
+#ifdef __linux__
+    (void)directoryPath;
+    return metadataFilter.matchesAt(directoryFd, name.data()); // name ends in the getdents buffer's NUL
+#else
+    (void)directoryFd;
+    return metadataFilter.matches((fs::path(directoryPath) / fs::path(name)).string());
+#endif
+}
+
+/**
+ * Matches an entry name and reports it, once per matching query with --queries.
+ * Metadata is only read for names that match.
+ */
+inline void matchEntry(const Matcher& matcher, std::string_view name, std::string_view directoryPath,
+    bool isDirectory, int directoryFd) {
+    if (!matcher.isBatch()) {
+        if (matcher.matches(name) && passesMetadata(directoryFd, name, directoryPath)) {
+            reportMatch(name, directoryPath, isDirectory);
+        }
+        return;
+    }
+
+    thread_local std::vector<uint32_t> queries;
+    matcher.matchingQueries(name, queries);
+    if (queries.empty() || !passesMetadata(directoryFd, name, directoryPath)) {
+        return;
+    }
+    for (uint32_t query : queries) {
+        reportMatch(name, directoryPath, isDirectory, query);
+    }
+}
+
+#ifdef QFS_HAVE_IO_URING
+/**
+ * Whether an entry name matches the pattern, or any query with --queries
+ */
+inline bool nameMatches(const Matcher& matcher, std::string_view name) {
+    if (!matcher.isBatch()) {
+        return matcher.matches(name);
+    }
+    thread_local std::vector<uint32_t> queries;
+    matcher.matchingQueries(name, queries);
+    return !queries.empty();
+}
+
+/**
+ * Reports an entry whose name and metadata matched, once per matching query with --queries
+ */
+inline void reportEntry(const Matcher& matcher, std::string_view name, std::string_view directoryPath,
+    bool isDirectory) {
+    if (!matcher.isBatch()) {
+        reportMatch(name, directoryPath, isDirectory);
+        return;
+    }
+    thread_local std::vector<uint32_t> queries;
+    matcher.matchingQueries(name, queries);
+    for (uint32_t query : queries) {
+        reportMatch(name, directoryPath, isDirectory, query);
+    }
+}
+
+constexpr size_t kMaxOpenedAhead = 4096; // Queued directories beyond which children are opened lazily
+
+/**
+ * io_uring variant of the entry loop in searchInDirectory. The directory is read
+ * in full first; then the type lookups of symlinks and DT_UNKNOWN entries, the
+ * opens of child directories and the metadata lookups of matching names each go
+ * to the kernel as one batch instead of one blocking syscall per entry. A call
+ * the ring could not run is made synchronously instead.
+ */
+void searchEntriesBatched(const DirectoryTask& directory, const Matcher& matcher,
+    const std::shared_ptr<DirectoryFd>& handle, const std::shared_ptr<const IgnoreScope>& ignore,
+    UringBatch& ring) {
+    using EntryType = DirectoryReader::EntryType;
+    struct BatchEntry {
+        size_t name;                     // Offset of the NUL-terminated name in names
+        size_t length;
+        EntryType type;
+        bool symlink;
+        bool descend;                    // False for a child directory on a mount that is not entered
+        int result;                      // Result of the entry's latest batched call
+    };
+
+    // Visits do not nest, so one set of buffers per worker suffices
+    thread_local std::string names;
+    thread_local std::vector<BatchEntry> entries;
+    thread_local std::vector<size_t> batch;
+    thread_local std::vector<struct statx> stats;
+
+    const int fd = handle->fd;
+    names.clear();
+    entries.clear();
+
+    // The getdents buffer is reused on refill, so names are copied out
+    DirectoryReader reader(fd, false);
+    DirectoryReader::Entry entry;
+    while (!searchCancelled.load(std::memory_order_relaxed) && reader.next(entry)) {
+        entries.push_back({ names.size(), entry.name.size(), entry.type, entry.symlink, true, 0 });
+        names.append(entry.name);
+        names += '\0';
+    }
+    auto nameOf = [](const BatchEntry& e) { return names.data() + e.name; };
+
+    // Types the file system did not report: one batch of lstat-like lookups, then one
+    // following the symlinks among them, which are classified by their target
+    batch.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (entries[i].type == EntryType::UNRESOLVED) {
+            batch.push_back(i);
+        }
+    }
+    for (int followLinks = 0; followLinks < 2 && !batch.empty(); followLinks++) {
+        stats.resize(batch.size());
+        for (size_t j = 0; j < batch.size(); j++) {
+            BatchEntry& e = entries[batch[j]];
+            ring.statxAt(fd, nameOf(e), followLinks ? 0 : AT_SYMLINK_NOFOLLOW, STATX_TYPE, &stats[j], &e.result);
+        }
+        ring.submit();
+
+        size_t links = 0;
+        for (size_t j = 0; j < batch.size(); j++) {
+            BatchEntry& e = entries[batch[j]];
+            if (e.result == UringBatch::kNotRun) {
+                e.type = DirectoryReader::classifyAt(fd, nameOf(e), e.symlink);
+            }
+            else if (e.result < 0) {
+                e.type = EntryType::OTHER;
+            }
+            else if (!followLinks && S_ISLNK(stats[j].stx_mode)) {
+                e.symlink = true;
+                batch[links++] = batch[j];
+            }
+            else {
+                e.type = DirectoryReader::typeFromMode(stats[j].stx_mode);
+            }
+        }
+        batch.resize(links);
+    }
+
+    // Excluded entries are neither searched nor reported
+    if (ignore) {
+        for (auto& e : entries) {
+            if ((e.type == EntryType::DIRECTORY || e.type == EntryType::REGULAR) &&
+                ignore->excludes(directory.path.path, std::string_view(nameOf(e), e.length),
+                    e.type == EntryType::DIRECTORY)) {
+                e.type = EntryType::OTHER;
+            }
+        }
+    }
+
+    // Open child directories as one batch while the queue is short; a long queue
+    // already holds enough work, and every child opened ahead pins a descriptor.
+    // Symlinked directories are not followed.
+    size_t openBudget = 0;
+    if (!searchCancelled.load(std::memory_order_relaxed)) {
+        const size_t waiting = traversalPool.queuedCount();
+        openBudget = waiting < kMaxOpenedAhead ? kMaxOpenedAhead - waiting : 0;
+    }
+    batch.clear();
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].result = UringBatch::kNotRun;
+        if (entries[i].type == EntryType::DIRECTORY && !entries[i].symlink && batch.size() < openBudget) {
+            batch.push_back(i);
+        }
+    }
+
+    // Their mount boundaries are checked first, as one batch of cached-attribute lookups;
+    // children left for later are checked when they open themselves
+    if (mountFilter.active() && !batch.empty()) {
+        stats.resize(batch.size());
+        for (size_t j = 0; j < batch.size(); j++) {
+            BatchEntry& e = entries[batch[j]];
+            ring.statxAt(fd, nameOf(e), MountFilter::kStatxFlags, 0, &stats[j], &e.result);
+        }
+        ring.submit();
+
+        size_t allowed = 0;
+        for (size_t j = 0; j < batch.size(); j++) {
+            BatchEntry& e = entries[batch[j]];
+            if (e.result == UringBatch::kNotRun) {
+                e.descend = mountFilter.allowsAt(fd, nameOf(e));
+            }
+            else if (e.result == 0) {
+                e.descend = mountFilter.allows(static_cast<uint64_t>(makedev(stats[j].stx_dev_major,
+                    stats[j].stx_dev_minor)));
+            }
+            e.result = UringBatch::kNotRun;
+            if (e.descend) {
+                batch[allowed++] = batch[j];
+            }
+        }
+        batch.resize(allowed);
+    }
+
+    for (size_t index : batch) {
+        ring.openAt(fd, nameOf(entries[index]), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC,
+            &entries[index].result);
+    }
+    ring.submit();
+    for (const auto& e : entries) {
+        if (e.type != EntryType::DIRECTORY || e.symlink || !e.descend) {
+            continue;
+        }
+        // Missing or unreadable children are skipped, as their own open would fail;
+        // when descriptors ran out the child opens itself later
+        if (e.result < 0 && e.result != UringBatch::kNotRun && e.result != -EMFILE && e.result != -ENFILE) {
+            continue;
+        }
+        std::string_view name(nameOf(e), e.length);
+        PathRef childPath = PathArena::append(directory.path.path, name);
+        size_t nameOffset = childPath.path.size() - name.size();
+        if (e.result >= 0) {
+            launchSearch({ nullptr, std::move(childPath), nameOffset, std::make_shared<DirectoryFd>(e.result), ignore });
+        }
+        else {
+            launchSearch({ handle, std::move(childPath), nameOffset, nullptr, ignore });
+        }
+    }
+
+    // Names are matched first; metadata is only looked up, as one batch, for those that match
+    batch.clear();
+    for (size_t i = 0; i < entries.size() && !searchCancelled.load(std::memory_order_relaxed); i++) {
+        const BatchEntry& e = entries[i];
+        const bool isDirectory = e.type == EntryType::DIRECTORY;
+        if (e.type != EntryType::REGULAR && !(isDirectory && searchDirectories)) {
+            continue;
+        }
+        std::string_view name(nameOf(e), e.length);
+        if (!metadataFilter.active()) {
+            matchEntry(matcher, name, directory.path.path, isDirectory, fd);
+        }
+        else if (nameMatches(matcher, name)) {
+            batch.push_back(i);
+        }
+    }
+    if (batch.empty()) {
+        return;
+    }
+
+    stats.resize(batch.size());
+    for (size_t j = 0; j < batch.size(); j++) {
+        BatchEntry& e = entries[batch[j]];
+        ring.statxAt(fd, nameOf(e), AT_STATX_SYNC_AS_STAT, metadataFilter.statxMask(), &stats[j], &e.result);
+    }
+    ring.submit();
+    for (size_t j = 0; j < batch.size(); j++) {
+        const BatchEntry& e = entries[batch[j]];
+        const bool passes = e.result == UringBatch::kNotRun
+            ? metadataFilter.matchesAt(fd, nameOf(e))
+            : e.result == 0 && metadataFilter.matchesStatx(stats[j]);
+        if (passes) {
+            reportEntry(matcher, std::string_view(nameOf(e), e.length), directory.path.path,
+                e.type == EntryType::DIRECTORY);
+        }
+    }
+}
+#endif
+
+/**
+ * Searches for files and optionally directories in a directory and its subdirectories
+ */
+void searchInDirectory(const DirectoryTask& directory, const Matcher& matcher) {
+#ifdef __linux__
+    // Children are opened relative to the parent descriptor without following
+    // symlinks, so the kernel never re-resolves the full path. O_DIRECTORY also
+    // replaces the exists/is_directory checks.
+    std::shared_ptr<DirectoryFd> handle = directory.opened;
+    if (!handle) {
+        const char* path = directory.path.path.data();
+        if (directory.parent && mountFilter.active() &&
+            !mountFilter.allowsAt(directory.parent->fd, path + directory.nameOffset)) {
+            return; // A mount that is not entered (--xdev, --skip-fstype or a pseudo file system)
+        }
+        int opened = directory.parent
+            ? openat(directory.parent->fd, path + directory.nameOffset,
+                O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC)
+            : open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (opened < 0) {
+            return; // Missing, not a directory or permission denied
+        }
+        handle = std::make_shared<DirectoryFd>(opened);
+    }
+
+    const int fd = handle->fd;
+    if (recordDirectoryStamps) {
+        struct stat st;
+        if (fstat(fd, &st) == 0) {
+            stampCollector.add({ std::string(directory.path.path), stampFromStat(st) });
+        }
+    }
+
+    // A directory's ignore files apply to its own entries and everything below it
+    std::shared_ptr<const IgnoreScope> ignore = directory.ignore;
+    if (useIgnoreFiles) {
+        ignore = loadIgnoreScope(fd, directory.path.path, std::move(ignore));
+    }
+
+#ifdef QFS_HAVE_IO_URING
+    if (ioBackend == IoBackend::URING) {
+        if (UringBatch* ring = workerRing()) {
+            searchEntriesBatched(directory, matcher, handle, ignore, *ring);
+            return;
+        }
+    }
+#endif
+
+    DirectoryReader reader(fd);
+    DirectoryReader::Entry entry;
+    while (!searchCancelled.load(std::memory_order_relaxed) && reader.next(entry)) {
+        if (entry.type == DirectoryReader::EntryType::DIRECTORY) {
+            // Excluded directories are pruned: never opened, searched or reported
+            if (ignore && ignore->excludes(directory.path.path, entry.name, true)) {
+                continue;
+            }
+
+            // Recurse into subdirectory (symlinked directories are not followed)
+            if (!entry.symlink) {
+                PathRef childPath = PathArena::append(directory.path.path, entry.name);
+                size_t nameOffset = childPath.path.size() - entry.name.size();
+                launchSearch({ handle, std::move(childPath), nameOffset, nullptr, ignore });
+            }
+
+            // Check if directory name matches when enabled
+            if (searchDirectories) {
+                matchEntry(matcher, entry.name, directory.path.path, true, fd);
+            }
+        }
+        else if (entry.type == DirectoryReader::EntryType::REGULAR &&
+            !(ignore && ignore->excludes(directory.path.path, entry.name, false))) {
+            matchEntry(matcher, entry.name, directory.path.path, false, fd);
+        }
+    }
+#else
+    try {
+        if (!fs::exists(directory) || !fs::is_directory(directory)) {
+            return;
+        }
+
+        // Paths below the absolute starting directory are already absolute
+        const std::string directoryPath = directory.string();
+        DirectoryStamp stamp;
+        if (recordDirectoryStamps && statDirectory(directoryPath, true, stamp)) {
+            stampCollector.add({ directoryPath, stamp });
+        }
+
+        for (const auto& entry : fs::directory_iterator(directory,
+            fs::directory_options::skip_permission_denied)) {
+            if (searchCancelled.load(std::memory_order_relaxed)) {
+                break;
+            }
+            try {
+                const bool isDirectory = entry.is_directory();
+                std::string entryName = entry.path().filename().string();
+                if (rootIgnoreScope && (isDirectory || entry.is_regular_file()) &&
+                    rootIgnoreScope->excludes(directoryPath, entryName, isDirectory)) {
+                    continue; // Excluded: neither searched nor reported
+                }
+
+                if (isDirectory) {
+                    // Recurse into subdirectory
+                    launchSearch(entry.path());
+
+                    // Check if directory name matches when enabled
+                    if (searchDirectories) {
+                        matchEntry(matcher, entryName, directoryPath, true, -1);
+                    }
+                }
+                else if (entry.is_regular_file()) {
+                    matchEntry(matcher, entryName, directoryPath, false, -1);
+                }
+            }
+            catch (...) {
+                // Ignore permission errors and continue searching
+            }
+        }
+    }
+    catch (...) {
+        // Ignore general filesystem errors
+    }
+#endif
+}
+
+/**
+ * Queues a directory for traversal by the worker pool
+ */
+void launchSearch(DirectoryTask directory) {
+    traversalPool.submit(std::move(directory));
+}
+
+/**
+ * Walks the tree below startingDir on the worker pool, reporting matches
+ */
+void runTraversal(const std::string& startingDir, const Matcher& matcher) {
+    // --exclude rules are relative to the starting directory
+    rootIgnoreScope = nullptr;
+    if (!excludeRules.empty()) {
+        auto scope = std::make_shared<IgnoreScope>();
+        scope->rules = excludeRules;
+        scope->baseLength = startingDir.size();
+        rootIgnoreScope = std::move(scope);
+    }
+
+#ifdef __linux__
+    // Each directory with queued children holds a descriptor open
+    struct rlimit fileLimit;
+    if (getrlimit(RLIMIT_NOFILE, &fileLimit) == 0 && fileLimit.rlim_cur < fileLimit.rlim_max) {
+        fileLimit.rlim_cur = fileLimit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &fileLimit);
+    }
+    DirectoryTask root{ nullptr, PathArena::append(startingDir, ""), 0, nullptr, rootIgnoreScope };
+#else
+    // Without per-directory state only the starting directory's ignore files apply
+    if (useIgnoreFiles) {
+        rootIgnoreScope = loadIgnoreScope(-1, startingDir, rootIgnoreScope);
+    }
+    DirectoryTask root = startingDir;
+#endif
+
+    traversalPool.run(std::move(root), maxThreads, [&](const DirectoryTask& directory) {
+        searchInDirectory(directory, matcher);
+        });
+}
+
+/**
+ * Appends value as a LEB128 varint
+ */
+void appendVarint(std::string& out, uint64_t value) {
+    while (value >= 0x80) {
+        out += static_cast<char>((value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+/**
+ * Reads a LEB128 varint, returning false if it runs past end
+ */
+bool readVarint(const uint8_t*& cursor, const uint8_t* end, uint64_t& value) {
+    value = 0;
+    for (int shift = 0; cursor < end && shift < 64; shift += 7) {
+        uint8_t byte = *cursor++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Filename index file layout (little-endian):
+ *   IndexHeader | root path | entries | block table
+ * Entries are sorted absolute paths, front-coded against the previous entry:
+ *   varint shared prefix length, varint suffix length, flags byte, suffix bytes,
+ *   and for directories with INDEX_STAMP the varint mtime seconds, mtime
+ *   nanoseconds, inode and device used by --index update.
+ * Every kIndexBlockSize-th entry restarts with no shared prefix, and the block
+ * table holds the file offset of each restart so blocks decode independently.
+ *
+ * After the block table come the trigram posting lists and the trigram table:
+ *   posting lists | TrigramSlot[trigramCount] sorted by trigram
+ * Every ASCII-lowercased 3-byte window of an entry's name has a slot whose
+ * posting list holds the ordinals of all entries containing it, ascending and
+ * delta-coded as varints.
+ */
+struct IndexHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t blockSize;          // Entries per restart block
+    uint64_t entryCount;
+    uint64_t blockCount;
+    uint64_t blockTableOffset;   // File offset of blockCount uint64 entry offsets
+    uint64_t rootLength;         // Root path follows the header
+    DirectoryStamp rootStamp;    // Stamp of the root directory itself
+    uint64_t trigramCount;
+    uint64_t trigramTableOffset; // File offset of trigramCount TrigramSlots
+};
+
+static_assert(sizeof(IndexHeader) == 96, "IndexHeader must have no padding");
+
+struct TrigramSlot {
+    uint64_t trigram;            // Three folded bytes, first byte highest
+    uint64_t count;              // Entries in the posting list
+    uint64_t offset;             // File offset of the posting list
+};
+
+static_assert(sizeof(TrigramSlot) == 24, "TrigramSlot must have no padding");
+
+constexpr char kIndexMagic[8] = { 'Q', 'F', 'S', 'I', 'D', 'X', '\0', '\0' };
+constexpr uint32_t kIndexVersion = 3;
+constexpr uint32_t kIndexBlockSize = 64;
+constexpr int kOrdinalBits = 40;         // Entry ordinal bits in a packed (trigram, ordinal) posting
+constexpr size_t kPostingRunLength = size_t(1) << 24; // Postings sorted in memory at once (128 MiB)
+constexpr size_t kPostingMergeBuffer = size_t(1) << 16; // Postings read ahead per spilled run
+
+enum IndexEntryFlags : uint8_t {
+    INDEX_DIRECTORY = 1,         // Entry is a directory
+    INDEX_STAMP = 2              // Directory stamp follows the name
+};
+
+/**
+ * One decoded index entry
+ */
+struct IndexEntry {
+    std::string path;            // Absolute path
+    bool isDirectory = false;
+    bool hasStamp = false;       // False for symlinked or unreadable directories
+    DirectoryStamp stamp;
+};
+
+/**
+ * Returns the last component of an indexed path
+ */
+std::string_view entryName(std::string_view path) {
+    size_t slash = path.find_last_of("/\\");
+    return slash == std::string_view::npos ? path : path.substr(slash + 1);
+}
+
+/**
+ * Calls visit(trigram) for every 3-byte window of text, ASCII-lowercased
+ */
+template <typename Visit>
+void forEachTrigram(std::string_view text, Visit visit) {
+    for (size_t i = 0; i + 3 <= text.size(); i++) {
+        visit((static_cast<uint32_t>(foldAscii(static_cast<unsigned char>(text[i]))) << 16) |
+            (static_cast<uint32_t>(foldAscii(static_cast<unsigned char>(text[i + 1]))) << 8) |
+            foldAscii(static_cast<unsigned char>(text[i + 2])));
+    }
+}
+
+/**
+ * Packed (trigram, ordinal) postings of an index being written, kept in sorted
+ * runs of at most kPostingRunLength. Full runs are spilled to files next to the
+ * index and k-way merged when read back, so building an index of any size needs
+ * a bounded amount of memory for its postings.
+ */
+class PostingRuns {
+public:
+    explicit PostingRuns(std::string filePrefix) : prefix(std::move(filePrefix)) {}
+    PostingRuns(const PostingRuns&) = delete;
+    PostingRuns& operator=(const PostingRuns&) = delete;
+
+    ~PostingRuns() {
+        std::error_code error;
+        for (size_t i = 0; i < runs.size(); i++) {
+            runs[i].file.close();
+            fs::remove(runName(i), error);
+        }
+    }
+
+    void add(uint64_t posting) {
+        buffer.push_back(posting);
+        if (buffer.size() >= kPostingRunLength) {
+            spill();
+        }
+    }
+
+    /**
+     * Ends the adding phase; false if a run could not be spilled or read back
+     */
+    bool finish() {
+        sortBuffer();
+        if (!runs.empty() && !buffer.empty()) {
+            spill();
+        }
+        for (size_t i = 0; i < runs.size() && !failed; i++) {
+            runs[i].file.close();
+            runs[i].file.open(runName(i), std::ios::binary | std::ios::in);
+            failed = !runs[i].file.is_open();
+            if (!failed && refill(runs[i])) {
+                heads.push({ runs[i].buffer[0], i });
+            }
+        }
+        return !failed;
+    }
+
+    /**
+     * Next posting in ascending order, without repeats; false at the end
+     */
+    bool next(uint64_t& posting) {
+        do {
+            if (runs.empty()) {
+                if (position >= buffer.size()) {
+                    return false;
+                }
+                posting = buffer[position++];
+            }
+            else {
+                if (heads.empty()) {
+                    return false;
+                }
+                auto [value, index] = heads.top();
+                heads.pop();
+                posting = value;
+                Run& run = runs[index];
+                if (++run.position < run.filled || refill(run)) {
+                    heads.push({ run.buffer[run.position], index });
+                }
+            }
+        } while (returned && posting == last);
+        returned = true;
+        last = posting;
+        return true;
+    }
+
+private:
+    struct Run {
+        std::fstream file;
+        std::vector<uint64_t> buffer;
+        size_t position = 0;
+        size_t filled = 0;
+    };
+
+    std::string runName(size_t index) const {
+        return prefix + "." + std::to_string(index);
+    }
+
+    void sortBuffer() {
+        std::sort(buffer.begin(), buffer.end());
+        buffer.erase(std::unique(buffer.begin(), buffer.end()), buffer.end());
+    }
+
+    void spill() {
+        sortBuffer();
+        runs.emplace_back();
+        Run& run = runs.back();
+        run.file.open(runName(runs.size() - 1), std::ios::binary | std::ios::out | std::ios::trunc);
+        run.file.write(reinterpret_cast<const char*>(buffer.data()),
+            static_cast<std::streamsize>(buffer.size() * sizeof(uint64_t)));
+        failed = failed || !run.file.good();
+        buffer.clear();
+    }
+
+    bool refill(Run& run) {
+        run.buffer.resize(kPostingMergeBuffer);
+        run.file.read(reinterpret_cast<char*>(run.buffer.data()),
+            static_cast<std::streamsize>(run.buffer.size() * sizeof(uint64_t)));
+        run.filled = static_cast<size_t>(run.file.gcount()) / sizeof(uint64_t);
+        run.position = 0;
+        return run.filled > 0;
+    }
+
+    std::string prefix;
+    std::vector<uint64_t> buffer;        // Current run, or all postings if none was spilled
+    size_t position = 0;                 // Read position in buffer when nothing was spilled
+    std::vector<Run> runs;
+    std::priority_queue<std::pair<uint64_t, size_t>, std::vector<std::pair<uint64_t, size_t>>,
+        std::greater<>> heads;           // Smallest unread posting of each run
+    uint64_t last = 0;
+    bool returned = false;
+    bool failed = false;
+};
+
+/**
+ * Writes entries (sorted by path) as a front-coded index file with a trigram table
+ */
+bool writeIndex(const std::string& filename, const std::string& root,
+    const DirectoryStamp& rootStamp, const std::vector<IndexEntry>& entries) {
+    // Write to a temporary file and rename it, so an interrupted update keeps the old index
+    const std::string temporary = filename + ".tmp";
+    std::ofstream output(temporary, std::ios::binary | std::ios::trunc);
+    if (!output.is_open()) {
+        std::cerr << "Error: Failed to create index file '" << filename << "'!\n";
+        return false;
+    }
+
+    IndexHeader header = {};
+    std::memcpy(header.magic, kIndexMagic, sizeof(header.magic));
+    header.version = kIndexVersion;
+    header.blockSize = kIndexBlockSize;
+    header.entryCount = entries.size();
+    header.blockCount = (entries.size() + kIndexBlockSize - 1) / kIndexBlockSize;
+    header.rootLength = root.size();
+    header.rootStamp = rootStamp;
+
+    std::vector<uint64_t> blockOffsets;
+    blockOffsets.reserve(header.blockCount);
+    uint64_t offset = sizeof(IndexHeader) + root.size();
+
+    // Header is rewritten once the block table offset is known
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.write(root.data(), static_cast<std::streamsize>(root.size()));
+
+    // (trigram << kOrdinalBits | ordinal) for every name; sorting groups each trigram's ordinals in order
+    PostingRuns postings(temporary);
+
+    std::string chunk;
+    std::string_view previous;
+    for (size_t i = 0; i < entries.size(); i++) {
+        const IndexEntry& entry = entries[i];
+        forEachTrigram(entryName(entry.path), [&](uint32_t trigram) {
+            postings.add((static_cast<uint64_t>(trigram) << kOrdinalBits) | i);
+            });
+
+        size_t shared = 0;
+        if (i % kIndexBlockSize == 0) {
+            blockOffsets.push_back(offset + chunk.size());
+        }
+        else {
+            size_t limit = std::min(previous.size(), entry.path.size());
+            while (shared < limit && previous[shared] == entry.path[shared]) {
+                shared++;
+            }
+        }
+
+        uint8_t flags = (entry.isDirectory ? INDEX_DIRECTORY : 0) |
+            (entry.isDirectory && entry.hasStamp ? INDEX_STAMP : 0);
+        appendVarint(chunk, shared);
+        appendVarint(chunk, entry.path.size() - shared);
+        chunk += static_cast<char>(flags);
+        chunk.append(entry.path, shared, std::string::npos);
+        if (flags & INDEX_STAMP) {
+            appendVarint(chunk, static_cast<uint64_t>(entry.stamp.mtimeSeconds));
+            appendVarint(chunk, static_cast<uint64_t>(entry.stamp.mtimeNanoseconds));
+            appendVarint(chunk, entry.stamp.inode);
+            appendVarint(chunk, entry.stamp.device);
+        }
+        previous = entry.path;
+
+        if (chunk.size() >= (1 << 20)) {
+            output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            offset += chunk.size();
+            chunk.clear();
+        }
+    }
+    output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    offset += chunk.size();
+
+    header.blockTableOffset = offset;
+    output.write(reinterpret_cast<const char*>(blockOffsets.data()),
+        static_cast<std::streamsize>(blockOffsets.size() * sizeof(uint64_t)));
+    offset += blockOffsets.size() * sizeof(uint64_t);
+
+    // Posting lists, one per distinct trigram (repeats within a name collapse here)
+    if (!postings.finish()) {
+        std::cerr << "Error: Failed to write temporary files for index '" << filename << "'!\n";
+        output.close();
+        std::error_code error;
+        fs::remove(temporary, error);
+        return false;
+    }
+    const uint64_t ordinalMask = (uint64_t(1) << kOrdinalBits) - 1;
+    std::vector<TrigramSlot> slots;
+    chunk.clear();
+    uint64_t posting = 0;
+    bool more = postings.next(posting);
+    while (more) {
+        TrigramSlot slot = { posting >> kOrdinalBits, 0, offset + chunk.size() };
+        uint64_t previousOrdinal = 0;
+        for (; more && (posting >> kOrdinalBits) == slot.trigram; more = postings.next(posting)) {
+            uint64_t ordinal = posting & ordinalMask;
+            appendVarint(chunk, ordinal - previousOrdinal);
+            previousOrdinal = ordinal;
+            slot.count++;
+        }
+        slots.push_back(slot);
+
+        if (chunk.size() >= (1 << 20)) {
+            output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+            offset += chunk.size();
+            chunk.clear();
+        }
+    }
+    output.write(chunk.data(), static_cast<std::streamsize>(chunk.size()));
+    offset += chunk.size();
+
+    header.trigramCount = slots.size();
+    header.trigramTableOffset = offset;
+    output.write(reinterpret_cast<const char*>(slots.data()),
+        static_cast<std::streamsize>(slots.size() * sizeof(TrigramSlot)));
+    output.seekp(0);
+    output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    output.close();
+
+    std::error_code error;
+    if (!output.good() || (fs::rename(temporary, filename, error), error)) {
+        std::cerr << "Error: Failed to write index file '" << filename << "'!\n";
+        fs::remove(temporary, error);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Read-only view of a whole file: mmapped on Linux, read into memory elsewhere
+ */
+class MappedFile {
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifdef __linux__
+        if (mapping) {
+            munmap(mapping, length);
+        }
+#endif
+    }
+
+    bool open(const std::string& filename) {
+#ifdef __linux__
+        int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            close(fd);
+            return false;
+        }
+        length = static_cast<size_t>(st.st_size);
+        void* address = mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+        mapping = address;
+        bytes = static_cast<const uint8_t*>(address);
+        return true;
+#else
+        std::ifstream input(filename, std::ios::binary);
+        if (!input.is_open()) {
+            return false;
+        }
+        contents.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+        length = contents.size();
+        bytes = reinterpret_cast<const uint8_t*>(contents.data());
+        return length > 0;
+#endif
+    }
+
+    const uint8_t* data() const {
+        return bytes;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const uint8_t* bytes = nullptr;
+    size_t length = 0;
+#ifdef __linux__
+    void* mapping = nullptr;
+#else
+    std::string contents;
+#endif
+};
+
+/**
+ * Reader for the front-coded filename index
+ */
+class IndexReader {
+public:
+    /**
+     * Maps and validates the index file, reporting problems to cerr
+     */
+    bool open(const std::string& filename) {
+        if (!file.open(filename)) {
+            std::cerr << "Error: Cannot open index file '" << filename << "'!\n";
+            return false;
+        }
+        if (file.size() < sizeof(IndexHeader)) {
+            std::cerr << "Error: '" << filename << "' is not a qfs index\n";
+            return false;
+        }
+
+        std::memcpy(&header, file.data(), sizeof(header));
+        const uint64_t size = file.size();
+        if (std::memcmp(header.magic, kIndexMagic, sizeof(kIndexMagic)) != 0 ||
+            header.version != kIndexVersion || header.blockSize == 0 ||
+            header.rootLength > size - sizeof(IndexHeader) ||
+            header.blockTableOffset > size ||
+            header.blockCount > (size - header.blockTableOffset) / sizeof(uint64_t) ||
+            header.trigramTableOffset > size ||
+            header.trigramCount > (size - header.trigramTableOffset) / sizeof(TrigramSlot)) {
+            std::cerr << "Error: '" << filename << "' is not a valid qfs index (rebuild it)\n";
+            return false;
+        }
+        return true;
+    }
+
+    std::string_view root() const {
+        return std::string_view(reinterpret_cast<const char*>(file.data()) + sizeof(IndexHeader),
+            header.rootLength);
+    }
+
+    const DirectoryStamp& rootStamp() const {
+        return header.rootStamp;
+    }
+
+    uint64_t entryCount() const {
+        return header.entryCount;
+    }
+
+    uint64_t blockCount() const {
+        return header.blockCount;
+    }
+
+    uint64_t blockSize() const {
+        return header.blockSize;
+    }
+
+    /**
+     * Narrows a query to the ordinals of entries whose names hold every
+     * trigram of the needles (see Matcher::requiredNeedles): AND intersects the needles' lists, OR unions
+     * them. Returns false when the trigram table cannot narrow the query (an OR
+     * needle or every AND needle shorter than three bytes), so all entries must
+     * be scanned. Candidates still have to be verified against the matcher.
+     */
+    bool trigramCandidates(const std::vector<std::string>& needles, SearchMode mode,
+        std::vector<uint64_t>& candidates) const {
+        bool narrowed = false;
+        candidates.clear();
+        for (const auto& needle : needles) {
+            if (needle.size() < 3) {
+                if (mode == SearchMode::AND) {
+                    continue;
+                }
+                return false;
+            }
+
+            std::vector<uint64_t> matches;
+            needleCandidates(needle, matches);
+            if (!narrowed) {
+                candidates = std::move(matches);
+            }
+            else {
+                std::vector<uint64_t> merged;
+                if (mode == SearchMode::AND) {
+                    std::set_intersection(candidates.begin(), candidates.end(), matches.begin(), matches.end(),
+                        std::back_inserter(merged));
+                }
+                else {
+                    std::set_union(candidates.begin(), candidates.end(), matches.begin(), matches.end(),
+                        std::back_inserter(merged));
+                }
+                candidates = std::move(merged);
+            }
+            narrowed = true;
+        }
+        return narrowed;
+    }
+
+    /**
+     * Decodes one block, calling visit(const IndexEntry&) for every entry in it.
+     * Returns false if the block is corrupt.
+     */
+    template <typename Visit>
+    bool forEachInBlock(uint64_t block, Visit visit) const {
+        uint64_t offset;
+        std::memcpy(&offset, file.data() + header.blockTableOffset + block * sizeof(uint64_t), sizeof(offset));
+        const uint8_t* cursor = file.data() + offset;
+        const uint8_t* end = file.data() + header.blockTableOffset;
+        if (offset > header.blockTableOffset) {
+            return false;
+        }
+
+        const uint64_t first = block * header.blockSize;
+        const uint64_t count = std::min<uint64_t>(header.blockSize, header.entryCount - first);
+        IndexEntry entry;
+        for (uint64_t i = 0; i < count; i++) {
+            uint64_t shared;
+            uint64_t suffix;
+            if (!readVarint(cursor, end, shared) || !readVarint(cursor, end, suffix) ||
+                shared > entry.path.size() || cursor >= end || suffix > static_cast<uint64_t>(end - cursor - 1)) {
+                return false;
+            }
+            uint8_t flags = *cursor++;
+            entry.path.resize(shared);
+            entry.path.append(reinterpret_cast<const char*>(cursor), suffix);
+            cursor += suffix;
+
+            entry.isDirectory = (flags & INDEX_DIRECTORY) != 0;
+            entry.hasStamp = (flags & INDEX_STAMP) != 0;
+            if (entry.hasStamp) {
+                uint64_t seconds;
+                uint64_t nanoseconds;
+                if (!readVarint(cursor, end, seconds) || !readVarint(cursor, end, nanoseconds) ||
+                    !readVarint(cursor, end, entry.stamp.inode) || !readVarint(cursor, end, entry.stamp.device)) {
+                    return false;
+                }
+                entry.stamp.mtimeSeconds = static_cast<int64_t>(seconds);
+                entry.stamp.mtimeNanoseconds = static_cast<int64_t>(nanoseconds);
+            }
+            visit(static_cast<const IndexEntry&>(entry));
+        }
+        return true;
+    }
+
+    /**
+     * Decodes every entry in path order
+     */
+    bool readAll(std::vector<IndexEntry>& entries) const {
+        entries.clear();
+        entries.reserve(header.entryCount);
+        for (uint64_t block = 0; block < header.blockCount; block++) {
+            if (!forEachInBlock(block, [&](const IndexEntry& entry) { entries.push_back(entry); })) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    /**
+     * Binary searches the trigram table; false if no name contains the trigram
+     */
+    bool findTrigram(uint32_t trigram, TrigramSlot& slot) const {
+        const uint8_t* table = file.data() + header.trigramTableOffset;
+        uint64_t low = 0;
+        uint64_t high = header.trigramCount;
+        while (low < high) {
+            uint64_t middle = low + (high - low) / 2;
+            std::memcpy(&slot, table + middle * sizeof(TrigramSlot), sizeof(slot));
+            if (slot.trigram == trigram) {
+                return slot.offset <= header.trigramTableOffset;
+            }
+            if (slot.trigram < trigram) {
+                low = middle + 1;
+            }
+            else {
+                high = middle;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Ordinals of entries whose names contain all trigrams of needle, found by
+     * intersecting posting lists from the shortest up
+     */
+    void needleCandidates(const std::string& needle, std::vector<uint64_t>& ordinals) const {
+        ordinals.clear();
+        std::vector<TrigramSlot> slots;
+        bool missing = false;
+        forEachTrigram(needle, [&](uint32_t trigram) {
+            TrigramSlot slot;
+            if (!findTrigram(trigram, slot)) {
+                missing = true;
+            }
+            else {
+                slots.push_back(slot);
+            }
+            });
+        if (missing || slots.empty()) {
+            return;
+        }
+        std::sort(slots.begin(), slots.end(), [](const TrigramSlot& a, const TrigramSlot& b) {
+            return a.count < b.count;
+            });
+
+        const uint8_t* end = file.data() + header.trigramTableOffset;
+        const uint8_t* cursor = file.data() + slots[0].offset;
+        ordinals.reserve(slots[0].count);
+        uint64_t ordinal = 0;
+        for (uint64_t i = 0; i < slots[0].count; i++) {
+            uint64_t delta;
+            if (!readVarint(cursor, end, delta)) {
+                break;
+            }
+            ordinal += delta;
+            ordinals.push_back(ordinal);
+        }
+
+        // Stream each longer list against the survivors, keeping only shared ordinals
+        for (size_t s = 1; s < slots.size() && !ordinals.empty(); s++) {
+            if (slots[s].trigram == slots[s - 1].trigram) {
+                continue;
+            }
+            cursor = file.data() + slots[s].offset;
+            ordinal = 0;
+            size_t kept = 0;
+            size_t next = 0;
+            for (uint64_t i = 0; i < slots[s].count && next < ordinals.size(); i++) {
+                uint64_t delta;
+                if (!readVarint(cursor, end, delta)) {
+                    break;
+                }
+                ordinal += delta;
+                while (next < ordinals.size() && ordinals[next] < ordinal) {
+                    next++;
+                }
+                if (next < ordinals.size() && ordinals[next] == ordinal) {
+                    ordinals[kept++] = ordinal;
+                    next++;
+                }
+            }
+            ordinals.resize(kept);
+        }
+    }
+
+    MappedFile file;
+    IndexHeader header = {};
+};
+
+/**
+ * Walks startingDir with a match-everything matcher and turns the collected
+ * records and directory stamps into index entries sorted by path.
+ * The stamp of startingDir itself is returned in rootStamp.
+ */
+bool walkIntoEntries(const std::string& startingDir, std::vector<IndexEntry>& entries,
+    DirectoryStamp& rootStamp) {
+    Matcher everything;
+    everything.compileMatchAll();
+    searchDirectories = true;
+    printDuringSearch = false;
+    recordDirectoryStamps = true;
+
+    runTraversal(startingDir, everything);
+    std::vector<MatchRecord> records = resultCollector.merge();
+    std::vector<StampRecord> stamps = stampCollector.merge();
+
+    // Both lists are sorted by path: attach each stamp to its directory entry
+    bool hasRootStamp = false;
+    size_t nextStamp = 0;
+    entries.clear();
+    entries.reserve(records.size());
+    for (auto& record : records) {
+        while (nextStamp < stamps.size() && stamps[nextStamp].path < record.path) {
+            if (stamps[nextStamp].path == startingDir) {
+                rootStamp = stamps[nextStamp].stamp;
+                hasRootStamp = true;
+            }
+            nextStamp++;
+        }
+
+        IndexEntry entry;
+        entry.path = std::move(record.path);
+        entry.isDirectory = record.isDirectory;
+        if (entry.isDirectory && nextStamp < stamps.size() && stamps[nextStamp].path == entry.path) {
+            entry.hasStamp = true;
+            entry.stamp = stamps[nextStamp++].stamp;
+        }
+        entries.push_back(std::move(entry));
+    }
+    for (; nextStamp < stamps.size() && !hasRootStamp; nextStamp++) {
+        if (stamps[nextStamp].path == startingDir) {
+            rootStamp = stamps[nextStamp].stamp;
+            hasRootStamp = true;
+        }
+    }
+    return hasRootStamp;
+}
+
+/**
+ * Walks startingDir once and writes every file and directory name to the index
+ */
+int buildIndex(const std::string& startingDir) {
+    std::vector<IndexEntry> entries;
+    DirectoryStamp rootStamp;
+    if (!walkIntoEntries(startingDir, entries, rootStamp)) {
+        std::cerr << "Error: Cannot read starting directory '" << startingDir << "'!\n";
+        return 1;
+    }
+
+    if (!writeIndex(indexFilename, startingDir, rootStamp, entries)) {
+        return 1;
+    }
+    std::cout << "Indexed " << entries.size() << " entries under " << startingDir
+        << " into " << indexFilename << "\n";
+    return 0;
+}
+
+/**
+ * Lists the immediate children of a directory: name, whether it is a directory
+ * and whether it is a symlink (symlinked directories are not descended)
+ */
+struct ListedEntry {
+    std::string name;
+    bool isDirectory;
+    bool symlink;
+};
+
+bool listDirectory(const std::string& path, std::vector<ListedEntry>& children) {
+    children.clear();
+#ifdef __linux__
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    DirectoryReader reader(fd);
+    DirectoryReader::Entry entry;
+    while (reader.next(entry)) {
+        if (entry.type != DirectoryReader::EntryType::OTHER) {
+            children.push_back({ std::string(entry.name),
+                entry.type == DirectoryReader::EntryType::DIRECTORY, entry.symlink });
+        }
+    }
+    close(fd);
+    return true;
+#else
+    std::error_code error;
+    for (fs::directory_iterator it(path, fs::directory_options::skip_permission_denied, error), end;
+        !error && it != end; it.increment(error)) {
+        bool isDirectory = it->is_directory(error);
+        if (!error && (isDirectory || it->is_regular_file(error))) {
+            children.push_back({ it->path().filename().string(), isDirectory, it->is_symlink(error) });
+        }
+        error.clear();
+    }
+    return true;
+#endif
+}
+
+/**
+ * Refreshes the index: stats every indexed directory in parallel, re-reads only
+ * those whose stamp changed and walks only directories that did not exist before
+ */
+int updateIndex() {
+    std::vector<IndexEntry> entries;
+    std::string root;
+    DirectoryStamp oldRootStamp;
+    {
+        IndexReader index;
+        if (!index.open(indexFilename)) {
+            return 1;
+        }
+        root = std::string(index.root());
+        stripTrailingSeparators(root); // Indexes written before roots were normalized
+        oldRootStamp = index.rootStamp();
+        mountFilter.configure(root, sameFileSystem, skipFileSystemTypes);
+        if (!index.readAll(entries)) {
+            std::cerr << "Error: Index file is damaged (rebuild it)\n";
+            return 1;
+        }
+    }
+
+    // The parent of a top-level entry is the root itself: "/" or "C:\\"
+    auto parentOf = [](std::string_view path) {
+        size_t slash = path.find_last_of("/\\");
+        if (slash == std::string_view::npos) {
+            return std::string_view();
+        }
+        const bool atRoot = slash == 0 || (slash == 2 && path[1] == ':');
+        return path.substr(0, atRoot ? slash + 1 : slash);
+    };
+
+    // Directories to check: the root and every indexed directory, parents before children
+    struct DirectoryCheck {
+        std::string_view path;
+        const IndexEntry* entry = nullptr; // Null for the root
+        DirectoryStamp stamp;        // Freshly read stamp
+        bool exists = false;         // Still a real directory we can descend into (not a skipped mount)
+        bool changed = false;        // Must be listed again
+        bool descend = false;        // Its subtree stays in the index
+    };
+    std::vector<DirectoryCheck> checks(1);
+    checks[0].path = root;
+    checks[0].entry = nullptr;
+    for (const auto& entry : entries) {
+        if (entry.isDirectory) {
+            checks.emplace_back();
+            checks.back().path = entry.path;
+            checks.back().entry = &entry;
+        }
+    }
+
+    std::atomic<size_t> nextCheck(0);
+    auto statWorker = [&]() {
+        for (size_t i = nextCheck++; i < checks.size(); i = nextCheck++) {
+            DirectoryCheck& check = checks[i];
+            check.exists = statDirectory(std::string(check.path), check.entry == nullptr, check.stamp) &&
+                (check.entry == nullptr || mountFilter.allows(check.stamp.device));
+            const bool hadStamp = check.entry ? check.entry->hasStamp : true;
+            const DirectoryStamp& oldStamp = check.entry ? check.entry->stamp : oldRootStamp;
+            check.changed = check.exists && (!hadStamp || check.stamp != oldStamp);
+        }
+        };
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::max(static_cast<int>(maxThreads), 1); i++) {
+        workers.emplace_back(statWorker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    if (!checks[0].exists) {
+        std::cerr << "Error: Indexed directory '" << root << "' no longer exists!\n";
+        return 1;
+    }
+
+    // A subtree is kept only while every directory above it still exists
+    std::unordered_map<std::string_view, DirectoryCheck*> byPath;
+    byPath.reserve(checks.size());
+    std::sort(checks.begin() + 1, checks.end(), [](const DirectoryCheck& a, const DirectoryCheck& b) {
+        return a.path.size() < b.path.size();
+        });
+    for (auto& check : checks) {
+        auto parent = byPath.find(parentOf(check.path));
+        bool parentDescends = check.entry == nullptr || (parent != byPath.end() && parent->second->descend);
+        check.descend = parentDescends && check.exists;
+        byPath[check.path] = &check;
+    }
+
+    // Keep entries whose parent is still descended into and has not changed
+    // (copied, since the checks refer to the old entries' paths)
+    std::vector<IndexEntry> updated;
+    updated.reserve(entries.size());
+    std::vector<const DirectoryCheck*> changedDirectories;
+    for (const auto& check : checks) {
+        if (check.descend && check.changed) {
+            changedDirectories.push_back(&check);
+        }
+    }
+    for (const auto& entry : entries) {
+        auto parent = byPath.find(parentOf(entry.path));
+        if (parent != byPath.end() && parent->second->descend && !parent->second->changed) {
+            updated.push_back(entry);
+            if (entry.isDirectory) {
+                const DirectoryCheck* self = byPath[entry.path];
+                updated.back().hasStamp = self->exists;
+                updated.back().stamp = self->stamp;
+            }
+        }
+    }
+
+    // Re-list changed directories; subdirectories that are new get walked in full
+    const char separator = static_cast<char>(fs::path::preferred_separator);
+    std::vector<std::string> newDirectories;
+    std::vector<ListedEntry> children;
+    for (const DirectoryCheck* check : changedDirectories) {
+        std::string directory(check->path);
+        if (!listDirectory(directory, children)) {
+            continue;
+        }
+        for (auto& child : children) {
+            IndexEntry entry;
+            entry.path = directory;
+            if (entry.path.back() != '/' && entry.path.back() != separator) {
+                entry.path += separator;
+            }
+            entry.path += child.name;
+            entry.isDirectory = child.isDirectory;
+
+            if (child.isDirectory && !child.symlink) {
+                auto known = byPath.find(entry.path);
+                DirectoryStamp stamp;
+                if (known != byPath.end() && known->second->exists) {
+                    entry.hasStamp = true;
+                    entry.stamp = known->second->stamp;
+                }
+                else if (mountFilter.active() && statDirectory(entry.path, false, stamp) &&
+                    !mountFilter.allows(stamp.device)) {
+                    // A mount that is not entered: listed without its contents
+                }
+                else {
+                    newDirectories.push_back(entry.path);
+                    continue; // Added with its stamp by the walk below
+                }
+            }
+            updated.push_back(std::move(entry));
+        }
+    }
+
+    for (const auto& directory : newDirectories) {
+        std::vector<IndexEntry> subtree;
+        IndexEntry self;
+        self.path = directory;
+        self.isDirectory = true;
+        self.hasStamp = walkIntoEntries(directory, subtree, self.stamp);
+        updated.push_back(std::move(self));
+        std::move(subtree.begin(), subtree.end(), std::back_inserter(updated));
+    }
+
+    std::sort(updated.begin(), updated.end(), [](const IndexEntry& a, const IndexEntry& b) {
+        return a.path < b.path;
+        });
+
+    if (!writeIndex(indexFilename, root, checks[0].stamp, updated)) {
+        return 1;
+    }
+    std::cout << "Updated " << indexFilename << ": " << changedDirectories.size()
+        << " changed directories re-read, " << newDirectories.size() << " new directories walked, "
+        << updated.size() << " entries\n";
+    return 0;
+}
+
+/**
+ * Matches indexed names against matcher, decoding blocks in parallel.
+ * Required literals first narrow the entries through the trigram table, so only
+ * blocks holding candidates are decoded and only candidates are verified.
+ * When scope is not empty only entries below that directory are reported.
+ */
+void queryIndex(const IndexReader& index, const Matcher& matcher, const std::string& scope) {
+    std::string prefix = scope;
+    if (!prefix.empty() && prefix.back() != '/' && prefix.back() != fs::path::preferred_separator) {
+        prefix += static_cast<char>(fs::path::preferred_separator);
+    }
+
+    auto consider = [&](const IndexEntry& entry) {
+        const std::string& path = entry.path;
+        const bool isDirectory = entry.isDirectory;
+        if (isDirectory && !searchDirectories) {
+            return;
+        }
+        if (path.compare(0, prefix.size(), prefix) != 0) {
+            return;
+        }
+        size_t slash = path.find_last_of("/\\");
+        size_t nameOffset = slash == std::string::npos ? 0 : slash + 1;
+        if (matcher.matches(std::string_view(path).substr(nameOffset)) &&
+            (!metadataFilter.active() || metadataFilter.matches(path))) {
+            recordMatch({ path, static_cast<uint32_t>(nameOffset), isDirectory });
+        }
+        };
+
+    // Candidate ordinals grouped by block: groups[g] .. groups[g + 1] share a block
+    std::vector<uint64_t> candidates;
+    std::vector<size_t> groups;
+    std::vector<std::string> required;
+    const SearchMode requiredMode = matcher.requiredNeedles(required);
+    const bool narrowed = index.trigramCandidates(required, requiredMode, candidates);
+    if (narrowed) {
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (i == 0 || candidates[i] / index.blockSize() != candidates[i - 1] / index.blockSize()) {
+                groups.push_back(i);
+            }
+        }
+        groups.push_back(candidates.size());
+    }
+    const uint64_t workCount = narrowed ? groups.size() - 1 : index.blockCount();
+
+    std::atomic<uint64_t> nextWork(0);
+    std::atomic<bool> corrupt(false);
+    auto worker = [&]() {
+        for (uint64_t work = nextWork++; work < workCount && !searchCancelled; work = nextWork++) {
+            bool valid;
+            if (!narrowed) {
+                valid = index.forEachInBlock(work, consider);
+            }
+            else {
+                const uint64_t block = candidates[groups[work]] / index.blockSize();
+                uint64_t ordinal = block * index.blockSize();
+                size_t next = groups[work];
+                valid = index.forEachInBlock(block, [&](const IndexEntry& entry) {
+                    if (next < groups[work + 1] && candidates[next] == ordinal++) {
+                        next++;
+                        consider(entry);
+                    }
+                    });
+            }
+            if (!valid) {
+                corrupt = true;
+            }
+        }
+        };
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < std::max(static_cast<int>(maxThreads), 1); i++) {
+        workers.emplace_back(worker);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    if (corrupt) {
+        std::cerr << "Warning: Index file is damaged, some entries were skipped (rebuild it)\n";
+    }
+}
+
+/**
+ * Default daemon socket: $XDG_RUNTIME_DIR/qfs.sock, or qfs.sock in a private
+ * per-user directory in /tmp
+ */
+std::string daemonSocketPath() {
+    if (!socketFilename.empty()) {
+        return socketFilename;
+    }
+    const char* runtimeDir = std::getenv("XDG_RUNTIME_DIR");
+    if (runtimeDir && *runtimeDir) {
+        return std::string(runtimeDir) + "/qfs.sock";
+    }
+#ifdef __linux__
+    return "/tmp/qfs-" + std::to_string(getuid()) + "/qfs.sock";
+#else
+    return "qfs.sock";
+#endif
+}
+
+#ifdef __linux__
+/**
+ * In-memory copy of a directory tree kept current with inotify.
+ * Nodes live in one vector and names in one append-only buffer; a node is
+ * visible while it and all of its ancestors are alive, so removing a directory
+ * hides its whole subtree by clearing one flag.
+ */
+class ResidentTree {
+public:
+    ResidentTree() : stopFd(eventfd(0, EFD_CLOEXEC)) {}
+
+    ~ResidentTree() {
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+        }
+        if (stopFd >= 0) {
+            close(stopFd);
+        }
+    }
+
+    /**
+     * Walks root with the traversal pool and starts watching every directory
+     */
+    bool load(const std::string& rootPath) {
+        // One spelling of the root, so top-level entries find it as their parent
+        std::string normalized = rootPath;
+        stripTrailingSeparators(normalized);
+        std::vector<IndexEntry> entries;
+        DirectoryStamp rootStamp;
+        if (!walkIntoEntries(normalized, entries, rootStamp)) {
+            return false;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        if (inotifyFd >= 0) {
+            close(inotifyFd);
+        }
+        inotifyFd = inotify_init1(IN_CLOEXEC);
+        if (inotifyFd < 0) {
+            std::cerr << "Error: inotify is not available: " << std::strerror(errno) << "\n";
+            return false;
+        }
+        watchLimitReported = false;
+
+        nodes.clear();
+        names.clear();
+        children.clear();
+        watches.clear();
+        freeNodes.clear();
+        deadNameBytes = 0;
+        orphansPending = false;
+        root = normalized;
+        nodes.push_back({ kNoParent, 0, 0, 0, true, true, false, -1 });
+        watchDirectory(0, root);
+
+        // Entries are sorted, so every directory precedes its children
+        std::unordered_map<std::string_view, uint32_t> directories;
+        directories.reserve(entries.size() / 4);
+        directories[root] = 0;
+        for (const auto& entry : entries) {
+            size_t slash = entry.path.find_last_of('/');
+            auto parent = directories.find(std::string_view(entry.path).substr(0, slash == 0 ? 1 : slash));
+            if (parent == directories.end()) {
+                continue;
+            }
+            uint32_t node = addNode(parent->second, std::string_view(entry.path).substr(slash + 1), entry.isDirectory);
+            if (entry.isDirectory && entry.hasStamp) {
+                directories[entry.path] = node;
+                watchDirectory(node, entry.path);
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Applies inotify events until stop() is called or the descriptor fails;
+     * reloads on overflow
+     */
+    void watchLoop() {
+        std::vector<char> buffer(256 * 1024);
+        while (true) {
+            pollfd ready[2] = { { inotifyFd, POLLIN, 0 }, { stopFd, POLLIN, 0 } };
+            if (poll(ready, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return;
+            }
+            if (ready[1].revents != 0) {
+                return;
+            }
+            ssize_t bytes = read(inotifyFd, buffer.data(), buffer.size());
+            if (bytes < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytes <= 0) {
+                return;
+            }
+
+            bool overflow = false;
+            {
+                std::unique_lock<std::shared_mutex> lock(mutex);
+                for (char* cursor = buffer.data(); cursor < buffer.data() + bytes; ) {
+                    const auto* event = reinterpret_cast<const inotify_event*>(cursor);
+                    cursor += sizeof(inotify_event) + event->len;
+                    if (event->mask & IN_Q_OVERFLOW) {
+                        overflow = true;
+                        break;
+                    }
+                    applyEvent(*event);
+                }
+                collectGarbage();
+            }
+
+            if (overflow) {
+                std::cerr << "Warning: inotify queue overflowed, reloading " << root << "\n";
+                std::string rootPath = root;
+                if (!load(rootPath)) {
+                    return;
+                }
+            }
+        }
+    }
+
+    /**
+     * Makes watchLoop return; called before the tree is destroyed
+     */
+    void stop() {
+        const uint64_t one = 1;
+        if (write(stopFd, &one, sizeof(one)) < 0) {
+            std::cerr << "Warning: Cannot stop the inotify watcher: " << std::strerror(errno) << "\n";
+        }
+    }
+
+    /**
+     * Calls visit(path, isDirectory) for every visible entry whose name matches,
+     * splitting the node list across workers
+     */
+    template <typename Visit>
+    void query(const Matcher& matcher, bool includeDirectories, int workerCount, Visit visit) const {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const size_t count = nodes.size();
+        const size_t stride = count / static_cast<size_t>(std::max(workerCount, 1)) + 1;
+
+        std::vector<std::thread> workers;
+        for (size_t begin = 1; begin < count; begin += stride) {
+            workers.emplace_back([&, begin]() {
+                std::string path;
+                for (size_t i = begin; i < std::min(begin + stride, count); i++) {
+                    const Node& node = nodes[i];
+                    if ((node.isDirectory && !includeDirectories) || !node.alive ||
+                        !matcher.matches(nameOf(node)) || !buildPath(static_cast<uint32_t>(i), path)) {
+                        continue;
+                    }
+                    visit(path, node.isDirectory);
+                }
+                });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    const std::string& rootPath() const {
+        return root;
+    }
+
+private:
+    static constexpr uint32_t kNoParent = UINT32_MAX;
+
+    struct Node {
+        uint32_t parent;
+        uint32_t nameOffset;     // Into names
+        uint32_t nameLength;
+        uint32_t childCount;     // Children still linked in children
+        bool isDirectory;
+        bool alive;
+        bool free;               // Released and waiting in freeNodes for reuse
+        int watch;               // inotify watch descriptor, -1 if none
+    };
+
+    static constexpr size_t kMinCompactNodes = 4096; // Smaller trees are not worth compacting
+
+    std::string_view nameOf(const Node& node) const {
+        return std::string_view(names).substr(node.nameOffset, node.nameLength);
+    }
+
+    static uint64_t childKey(uint32_t parent, std::string_view name) {
+        return std::hash<std::string_view>()(name) * 31 + parent;
+    }
+
+    uint32_t findChild(uint32_t parent, std::string_view name) const {
+        auto range = children.equal_range(childKey(parent, name));
+        for (auto it = range.first; it != range.second; ++it) {
+            const Node& node = nodes[it->second];
+            if (node.parent == parent && node.alive && nameOf(node) == name) {
+                return it->second;
+            }
+        }
+        return kNoParent;
+    }
+
+    uint32_t addNode(uint32_t parent, std::string_view name, bool isDirectory) {
+        const Node node{ parent, static_cast<uint32_t>(names.size()), static_cast<uint32_t>(name.size()),
+            0, isDirectory, true, false, -1 };
+        uint32_t index;
+        if (!freeNodes.empty()) {
+            index = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[index] = node;
+        }
+        else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.push_back(node);
+        }
+        names.append(name);
+        children.emplace(childKey(parent, name), index);
+        nodes[parent].childCount++;
+        return index;
+    }
+
+    /**
+     * Unlinks a node from its parent and stops watching it. Its slot is recycled
+     * at once unless it still has children, which are released by the next sweep.
+     */
+    void releaseNode(uint32_t index) {
+        Node& node = nodes[index];
+        auto range = children.equal_range(childKey(node.parent, nameOf(node)));
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == index) {
+                children.erase(it);
+                nodes[node.parent].childCount--;
+                break;
+            }
+        }
+        if (node.watch >= 0) {
+            inotify_rm_watch(inotifyFd, node.watch);
+            watches.erase(node.watch);
+            node.watch = -1;
+        }
+        node.alive = false;
+        deadNameBytes += node.nameLength;
+        if (node.childCount == 0) {
+            node.free = true;
+            freeNodes.push_back(index);
+        }
+        else {
+            orphansPending = true; // A directory moved away with its subtree
+        }
+    }
+
+    /**
+     * Releases the subtrees of directories moved out of the tree, then compacts
+     * nodes and names once half of them is dead. Runs after each batch of events.
+     */
+    void collectGarbage() {
+        if (orphansPending) {
+            orphansPending = false;
+            // Deepest first, so every directory's children are gone before it is freed
+            std::vector<std::pair<size_t, uint32_t>> orphans;
+            for (uint32_t i = 1; i < nodes.size(); i++) {
+                if (nodes[i].free) {
+                    continue;
+                }
+                size_t depth = 0;
+                bool orphaned = !nodes[i].alive;
+                for (uint32_t current = i; current != 0 && !orphaned; current = nodes[current].parent) {
+                    orphaned = !nodes[nodes[current].parent].alive;
+                    depth++;
+                }
+                if (orphaned) {
+                    orphans.emplace_back(depth, i);
+                }
+            }
+            std::sort(orphans.begin(), orphans.end(), std::greater<>());
+            for (const auto& orphan : orphans) {
+                Node& node = nodes[orphan.second];
+                if (node.alive) {
+                    releaseNode(orphan.second);
+                }
+                else if (!node.free && node.childCount == 0) {
+                    node.free = true;
+                    freeNodes.push_back(orphan.second);
+                }
+            }
+        }
+
+        if (nodes.size() >= kMinCompactNodes &&
+            (freeNodes.size() > nodes.size() / 2 || deadNameBytes > names.size() / 2)) {
+            compact();
+        }
+    }
+
+    /**
+     * Renumbers the live nodes densely and rewrites names without dead bytes
+     */
+    void compact() {
+        std::vector<uint32_t> remap(nodes.size(), kNoParent);
+        std::vector<Node> kept;
+        std::string keptNames;
+        kept.reserve(nodes.size() - freeNodes.size());
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            if (nodes[i].free) {
+                continue;
+            }
+            remap[i] = static_cast<uint32_t>(kept.size());
+            Node node = nodes[i];
+            node.nameOffset = static_cast<uint32_t>(keptNames.size());
+            keptNames.append(nameOf(nodes[i]));
+            kept.push_back(node);
+        }
+
+        children.clear();
+        for (uint32_t i = 1; i < kept.size(); i++) {
+            kept[i].parent = remap[kept[i].parent];
+        }
+        nodes = std::move(kept);
+        names = std::move(keptNames);
+        for (uint32_t i = 1; i < nodes.size(); i++) {
+            if (nodes[i].alive) {
+                children.emplace(childKey(nodes[i].parent, nameOf(nodes[i])), i);
+            }
+        }
+        for (auto& watch : watches) {
+            watch.second = remap[watch.second];
+        }
+        freeNodes.clear();
+        deadNameBytes = 0;
+    }
+
+    void watchDirectory(uint32_t node, const std::string& path) {
+        const uint32_t mask = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO |
+            IN_DELETE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW;
+        int watch = inotify_add_watch(inotifyFd, path.c_str(), mask);
+        if (watch < 0) {
+            if (errno == ENOSPC && !watchLimitReported) {
+                std::cerr << "Warning: inotify watch limit reached, some directories are not tracked "
+                    "(raise fs.inotify.max_user_watches)\n";
+                watchLimitReported = true;
+            }
+            return;
+        }
+        nodes[node].watch = watch;
+        watches[watch] = node;
+    }
+
+    /**
+     * Rebuilds the absolute path of a node; false if an ancestor was removed
+     */
+    bool buildPath(uint32_t index, std::string& path) const {
+        thread_local std::vector<uint32_t> chain;
+        chain.clear();
+        for (uint32_t current = index; current != 0; current = nodes[current].parent) {
+            if (!nodes[current].alive) {
+                return false;
+            }
+            chain.push_back(current);
+        }
+
+        path = root;
+        for (auto it = chain.rbegin(); it != chain.rend(); ++it) {
+            if (path.back() != '/') {
+                path += '/';
+            }
+            path.append(nameOf(nodes[*it]));
+        }
+        return true;
+    }
+
+    /**
+     * Adds a created or moved-in entry, reading new directories recursively
+     */
+    void addEntry(uint32_t parent, std::string_view name, const std::string& path) {
+        struct stat st;
+        if (lstat(path.c_str(), &st) != 0) {
+            return;
+        }
+
+        bool isDirectory = S_ISDIR(st.st_mode);
+        if (S_ISLNK(st.st_mode)) {
+            // Symlinks are classified by target but never descended
+            struct stat target;
+            if (stat(path.c_str(), &target) != 0 || !(S_ISDIR(target.st_mode) || S_ISREG(target.st_mode))) {
+                return;
+            }
+            addNode(parent, name, S_ISDIR(target.st_mode));
+            return;
+        }
+        if (!isDirectory && !S_ISREG(st.st_mode)) {
+            return;
+        }
+
+        uint32_t node = addNode(parent, name, isDirectory);
+        if (!isDirectory || !mountFilter.allows(static_cast<uint64_t>(st.st_dev))) {
+            return;
+        }
+
+        // Watch before listing so nothing created in between is missed
+        watchDirectory(node, path);
+        std::vector<ListedEntry> listed;
+        if (listDirectory(path, listed)) {
+            for (const auto& child : listed) {
+                if (findChild(node, child.name) == kNoParent) {
+                    addEntry(node, child.name, path + "/" + child.name);
+                }
+            }
+        }
+    }
+
+    void removeEntry(uint32_t parent, std::string_view name) {
+        uint32_t node = findChild(parent, name);
+        if (node != kNoParent) {
+            releaseNode(node);
+        }
+    }
+
+    void applyEvent(const inotify_event& event) {
+        auto watched = watches.find(event.wd);
+        if (watched == watches.end()) {
+            return;
+        }
+        uint32_t directory = watched->second;
+
+        if (event.mask & (IN_IGNORED | IN_DELETE_SELF)) {
+            if (event.mask & IN_IGNORED) {
+                watches.erase(watched);
+                nodes[directory].watch = -1;
+            }
+            return;
+        }
+        if (event.len == 0 || !nodes[directory].alive) {
+            return;
+        }
+
+        std::string_view name(event.name);
+        if (event.mask & (IN_DELETE | IN_MOVED_FROM)) {
+            removeEntry(directory, name);
+        }
+        else if (event.mask & (IN_CREATE | IN_MOVED_TO)) {
+            std::string path;
+            if (buildPath(directory, path)) {
+                removeEntry(directory, name); // Replaced by a rename over an existing entry
+                addEntry(directory, name, path + (path.back() == '/' ? "" : "/") + std::string(name));
             }
-            saveFilename = argv[++i];
-            i++;
         }
-        else if (arg == "--noverbose") {
-            printDuringSearch = false;
-            i++;
+    }
+
+    mutable std::shared_mutex mutex;     // Queries share, inotify updates are exclusive
+    std::string root;
+    std::vector<Node> nodes;             // nodes[0] is the root
+    std::string names;
+    std::unordered_multimap<uint64_t, uint32_t> children; // (parent, name) hash -> node
+    std::unordered_map<int, uint32_t> watches;            // inotify watch -> directory node
+    std::vector<uint32_t> freeNodes;     // Released slots, reused by addNode
+    size_t deadNameBytes = 0;            // Bytes of names no live node refers to
+    bool orphansPending = false;         // A released directory still has children
+    int inotifyFd = -1;
+    int stopFd = -1;                     // eventfd that ends watchLoop
+    bool watchLimitReported = false;
+};
+
+/**
+ * Writes all of data to a socket, ignoring a client that went away
+ */
+bool sendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
         }
-        else if (arg == "--searchdir") {
-            searchDirectories = true;
-            i++;
+        if (sent <= 0) {
+            return false;
         }
-        else {
-            std::cerr << "Error: Unknown option: " << arg << "\n";
-            printUsage(argv[0]);
+        data.remove_prefix(static_cast<size_t>(sent));
+    }
+    return true;
+}
+
+/**
+ * Reads one newline-terminated line from a socket
+ */
+bool receiveLine(int fd, std::string& line, std::string& pending) {
+    while (true) {
+        size_t newline = pending.find('\n');
+        if (newline != std::string::npos) {
+            line = pending.substr(0, newline);
+            pending.erase(0, newline + 1);
+            return true;
+        }
+        char chunk[64 * 1024];
+        ssize_t received = recv(fd, chunk, sizeof(chunk), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
             return false;
         }
+        pending.append(chunk, static_cast<size_t>(received));
     }
+}
 
-    if (targetPatterns.empty()) {
-        std::cerr << "Error: No target filename patterns specified!\n";
-        printUsage(argv[0]);
-        return false;
+/**
+ * Answers one client: the request is "Q <searchdir 0|1> TAB <scope> TAB <pattern>",
+ * the reply is one "F|D TAB <path>" line per match, or "E TAB <message>"
+ */
+void serveClient(int client, const ResidentTree& tree) {
+    // A client that never sends its request must not hold one of the serving slots
+    timeval timeout = { 10, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    std::string request;
+    std::string pending;
+    if (!receiveLine(client, request, pending) || request.size() < 4 || request[0] != 'Q') {
+        close(client);
+        return;
+    }
+
+    size_t scopeEnd = request.find('\t', 4);
+    if (scopeEnd == std::string::npos) {
+        sendAll(client, "E\tMalformed request\n");
+        close(client);
+        return;
+    }
+    const bool includeDirectories = request[2] == '1';
+    std::string scope = request.substr(4, scopeEnd - 4);
+    std::string pattern = request.substr(scopeEnd + 1);
+
+    std::vector<std::string> patterns;
+    SearchMode mode = SearchMode::OR;
+    PatternType type = PatternType::SIMPLE;
+    Matcher matcher;
+    if (!parseSearchPatterns(pattern, patterns, mode, type) || !matcher.compile(patterns, mode, type)) {
+        sendAll(client, "E\tInvalid search pattern\n");
+        close(client);
+        return;
     }
+    if (!scope.empty() && scope.back() != '/') {
+        scope += '/';
+    }
+
+    std::mutex replyMutex;
+    std::string reply;
+    tree.query(matcher, includeDirectories, maxThreads, [&](const std::string& path, bool isDirectory) {
+        if (path.compare(0, scope.size(), scope) != 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(replyMutex);
+        reply += isDirectory ? "D\t" : "F\t";
+        reply += path;
+        reply += '\n';
+        });
+    sendAll(client, reply);
+    close(client);
+}
 
+/**
+ * Creates the private directory of the default socket, or checks that an
+ * existing one is a real directory of this user that nobody else can write to,
+ * so another user cannot plant a socket there
+ */
+bool preparePrivateDirectory(const std::string& directory) {
+    if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST) {
+        std::cerr << "Error: Cannot create " << directory << ": " << std::strerror(errno) << "\n";
+        return false;
+    }
+    struct stat st;
+    if (lstat(directory.c_str(), &st) != 0 || !S_ISDIR(st.st_mode) || st.st_uid != getuid() ||
+        (st.st_mode & (S_IRWXG | S_IRWXO)) != 0) {
+        std::cerr << "Error: " << directory << " must be a directory owned by you with mode 0700\n";
+        return false;
+    }
     return true;
 }
 
 /**
- * Displays program usage information
+ * Whether path is a socket owned by this user; false if it is missing
  */
-void printUsage(const char* programName) {
-    std::cout << "Usage: " << programName << " <pattern> [options]\n";
-    std::cout << "   or: " << programName << " (for interactive mode)\n\n";
-    std::cout << "Patterns can include:\n";
-    std::cout << "  Simple patterns:            hello&&.exe (case-insensitive substring search)\n";
-    std::cout << "  Regular expressions (regex): /hello.*\\.exe/ (wrap regex in /.../)\n";
-    std::cout << "Important: In regex patterns, escape special characters properly:\n";
-    std::cout << "  - \\. for literal dot (not any character)\n";
-    std::cout << "  - \\\\ for literal backslash\n";
-    std::cout << "  - Use double backslashes in command line: /.*\\.txt/\n";
-    std::cout << "Logical operators:\n";
-    std::cout << "  pattern1&&pattern2    Find files matching ALL patterns (AND)\n";
-    std::cout << "  pattern1||pattern2    Find files matching ANY pattern (OR)\n";
-    std::cout << "  pattern               Find files matching single pattern\n\n";
-    std::cout << "Examples:\n";
-    std::cout << "  " << programName << " \"hello&&.exe\"          Find files with 'hello' AND '.exe' in name\n";
-    std::cout << "  " << programName << " \"hello||.exe\"          Find files with 'hello' OR '.exe' in name\n";
-    std::cout << "  " << programName << " \"/.*\\.(txt|md)/\"      Find all .txt and .md files (regex)\n";
-    std::cout << "  " << programName << " \"/XYZ_.+\\.bin/\"      Find files starting with XYZ_ and ending with .bin\n";
-    std::cout << "  " << programName << " \"/test[0-9]+\\.exe/\"  Find files like test1.exe, test42.exe (regex)\n";
-    std::cout << "  " << programName << " \"document\" --dir C:\\Users\n\n";
-    std::cout << "Options:\n";
-    std::cout << "  --threads <num>        Number of threads to use (1-"
-        << std::thread::hardware_concurrency() << ", default: all cores)\n";
-    std::cout << "  --dir <directory>      Starting directory (default: current directory)\n";
-    std::cout << "  --save <filename>      Save results to specified file\n";
-    std::cout << "  --noverbose            Do not print results during search\n";
-    std::cout << "  --searchdir            Include directory names in search\n";
-    std::cout << "  --help                 Show this help message\n";
+bool isOwnSocket(const std::string& path) {
+    struct stat st;
+    return lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode) && st.st_uid == getuid();
 }
 
 /**
- * Converts string to lowercase for case-insensitive comparison (simple mode)
+ * Opens a listening Unix domain socket that only this user can connect to,
+ * replacing a stale socket file of ours
  */
-std::string toLower(const std::string& str) {
-    std::string result = str;
-    std::transform(result.begin(), result.end(), result.begin(), ::tolower);
-    return result;
+int listenOnSocket(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        std::cerr << "Error: Socket path is too long: " << path << "\n";
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    if (socketFilename.empty() && !std::getenv("XDG_RUNTIME_DIR") &&
+        !preparePrivateDirectory(path.substr(0, path.find_last_of('/')))) {
+        return -1;
+    }
+    struct stat existing;
+    if (lstat(path.c_str(), &existing) == 0) {
+        if (!isOwnSocket(path) || unlink(path.c_str()) != 0) {
+            std::cerr << "Error: Cannot replace " << path << ": "
+                << (isOwnSocket(path) ? std::strerror(errno) : "not a socket owned by you") << "\n";
+            return -1;
+        }
+    }
+
+    int server = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (server < 0) {
+        return -1;
+    }
+    const mode_t previousMask = umask(077); // The socket file gets mode 0700
+    const bool bound = bind(server, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+    umask(previousMask);
+    if (!bound || listen(server, 64) != 0) {
+        std::cerr << "Error: Cannot listen on " << path << ": " << std::strerror(errno) << "\n";
+        close(server);
+        return -1;
+    }
+    return server;
 }
 
 /**
- * Checks if filename matches patterns based on search mode and pattern type
+ * Connects to the daemon socket. Both the socket file and the process serving
+ * it must belong to this user, so a socket planted by someone else is never
+ * trusted with a query or believed in its answers.
  */
-bool matchesPatterns(const std::string& filename, const std::vector<std::string>& patterns,
-    SearchMode mode, PatternType patternType) {
+int connectToSocket(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
 
-    if (patternType == PatternType::SIMPLE) {
-        // Simple substring search (case-insensitive)
-        std::string lowerFilename = toLower(filename);
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && !isOwnSocket(path)) {
+        std::cerr << "Error: " << path << " is not a socket owned by you\n";
+        return -1;
+    }
 
-        if (mode == SearchMode::OR) {
-            // Match ANY pattern (OR logic)
-            for (const auto& pattern : patterns) {
-                std::string lowerPattern = toLower(pattern);
-                if (lowerFilename.find(lowerPattern) != std::string::npos) {
-                    return true;
-                }
-            }
-            return false;
-        }
-        else if (mode == SearchMode::AND) {
-            // Match ALL patterns (AND logic)
-            for (const auto& pattern : patterns) {
-                std::string lowerPattern = toLower(pattern);
-                if (lowerFilename.find(lowerPattern) == std::string::npos) {
-                    return false;
-                }
-            }
-            return true;
-        }
-        else {
-            // SINGLE mode - match the only pattern
-            std::string lowerPattern = toLower(patterns[0]);
-            return lowerFilename.find(lowerPattern) != std::string::npos;
-        }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
     }
-    else {
-        // REGEX mode
-        if (mode == SearchMode::OR) {
-            // Match ANY pattern (OR logic)
-            for (const auto& pattern : patterns) {
-                try {
-                    std::regex re(pattern, std::regex::icase | std::regex::ECMAScript);
-                    if (std::regex_match(filename, re)) {
-                        return true;
-                    }
-                }
-                catch (const std::regex_error& e) {
-                    std::lock_guard<std::mutex> coutLock(coutMutex);
-                    std::cerr << "Regex error for pattern '" << pattern << "': " << e.what() << "\n";
-                    return false;
-                }
-            }
-            return false;
-        }
-        else if (mode == SearchMode::AND) {
-            // Match ALL patterns (AND logic)
-            for (const auto& pattern : patterns) {
-                try {
-                    std::regex re(pattern, std::regex::icase | std::regex::ECMAScript);
-                    if (!std::regex_match(filename, re)) {
-                        return false;
-                    }
-                }
-                catch (const std::regex_error& e) {
-                    std::lock_guard<std::mutex> coutLock(coutMutex);
-                    std::cerr << "Regex error for pattern '" << pattern << "': " << e.what() << "\n";
-                    return false;
-                }
-            }
-            return true;
-        }
-        else {
-            // SINGLE mode - match the only pattern
-            try {
-                std::regex re(patterns[0], std::regex::icase | std::regex::ECMAScript);
-                return std::regex_match(filename, re);
-            }
-            catch (const std::regex_error& e) {
-                std::lock_guard<std::mutex> coutLock(coutMutex);
-                std::cerr << "Regex error for pattern '" << patterns[0] << "': " << e.what() << "\n";
-                return false;
-            }
-        }
+
+    ucred peer = {};
+    socklen_t length = sizeof(peer);
+    if (fd >= 0 && (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &peer, &length) != 0 || peer.uid != getuid())) {
+        std::cerr << "Error: The daemon on " << path << " is run by another user\n";
+        close(fd);
+        return -1;
     }
+    return fd;
 }
+#endif
+
+constexpr size_t kMaxDaemonClients = 64; // Connections served at once; more wait in the listen backlog
+constexpr auto kAcceptRetryDelay = std::chrono::milliseconds(100); // After running out of descriptors
 
 /**
- * Searches for files and optionally directories in a directory and its subdirectories
+ * Loads startingDir into memory, keeps it current with inotify and serves
+ * queries on the daemon socket until killed
  */
-void searchInDirectory(const fs::path& directory, const std::vector<std::string>& filenamePatterns,
-    SearchMode mode, PatternType patternType) {
-    try {
-        if (!fs::exists(directory) || !fs::is_directory(directory)) {
-            return;
-        }
+int runDaemon(const std::string& startingDir) {
+#ifdef __linux__
+    ResidentTree tree;
+    if (!tree.load(startingDir)) {
+        std::cerr << "Error: Cannot load '" << startingDir << "'!\n";
+        return 1;
+    }
 
-        for (const auto& entry : fs::directory_iterator(directory,
-            fs::directory_options::skip_permission_denied)) {
-            try {
-                if (entry.is_directory()) {
-                    // Recurse into subdirectory
-                    launchSearch(entry.path(), filenamePatterns, mode, patternType);
+    const std::string path = daemonSocketPath();
+    int server = listenOnSocket(path);
+    if (server < 0) {
+        return 1;
+    }
+    std::cout << "Serving " << startingDir << " on " << path << std::endl;
 
-                    // Check if directory name matches when enabled
-                    if (searchDirectories) {
-                        std::string dirName = entry.path().filename().string();
-                        if (matchesPatterns(dirName, filenamePatterns, mode, patternType)) {
-                            std::string absolutePath = fs::absolute(entry.path()).string();
-                            std::string result = "Found directory " + dirName + " at: " + absolutePath;
-
-                            {
-                                std::lock_guard<std::mutex> lock(resultsMutex);
-                                searchResults.push_back(result);
-                            }
-
-                            if (printDuringSearch) {
-                                std::lock_guard<std::mutex> coutLock(coutMutex);
-                                std::cout << "Found directory "
-                                    << rang::fg::green << rang::style::bold << dirName
-                                    << rang::style::reset << rang::fg::reset
-                                    << " at: " << absolutePath << std::endl;
-                            }
-                        }
-                    }
-                }
-                else if (entry.is_regular_file()) {
-                    std::string entryFilename = entry.path().filename().string();
-                    if (matchesPatterns(entryFilename, filenamePatterns, mode, patternType)) {
-                        std::string absolutePath = fs::absolute(entry.path()).string();
-                        std::string result = "Found " + entryFilename + " at: " + absolutePath;
-
-                        {
-                            std::lock_guard<std::mutex> lock(resultsMutex);
-                            searchResults.push_back(result);
-                        }
-
-                        if (printDuringSearch) {
-                            std::lock_guard<std::mutex> coutLock(coutMutex);
-                            std::cout << "Found "
-                                << rang::fg::green << rang::style::bold << entryFilename
-                                << rang::style::reset << rang::fg::reset
-                                << " at: " << absolutePath << std::endl;
-                        }
-                    }
-                }
+    std::thread watcher([&tree]() { tree.watchLoop(); });
+
+    // Client threads reference tree, so they are counted and drained before it goes away
+    std::mutex clientMutex;
+    std::condition_variable clientDone;
+    size_t activeClients = 0;
+    bool retrying = false;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(clientMutex);
+            clientDone.wait(lock, [&]() { return activeClients < kMaxDaemonClients; });
+        }
+
+        int client = accept4(server, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
             }
-            catch (...) {
-                // Ignore permission errors and continue searching
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM) {
+                if (!retrying) {
+                    std::cerr << "Warning: accept failed: " << std::strerror(errno) << ", retrying\n";
+                    retrying = true;
+                }
+                std::this_thread::sleep_for(kAcceptRetryDelay);
+                continue;
             }
+            std::cerr << "Error: accept failed: " << std::strerror(errno) << "\n";
+            break;
+        }
+        retrying = false;
+
+        {
+            std::lock_guard<std::mutex> lock(clientMutex);
+            activeClients++;
+        }
+        try {
+            std::thread([client, &tree, &clientMutex, &clientDone, &activeClients]() {
+                serveClient(client, tree);
+                std::lock_guard<std::mutex> lock(clientMutex);
+                activeClients--;
+                clientDone.notify_all();
+                }).detach();
+        }
+        catch (const std::system_error&) {
+            close(client);
+            std::lock_guard<std::mutex> lock(clientMutex);
+            activeClients--;
         }
     }
-    catch (...) {
-        // Ignore general filesystem errors
+    close(server);
+    unlink(path.c_str());
+
+    {
+        std::unique_lock<std::mutex> lock(clientMutex);
+        clientDone.wait(lock, [&]() { return activeClients == 0; });
     }
+    tree.stop();
+    watcher.join();
+    return 1;
+#else
+    (void)startingDir;
+    std::cerr << "Error: --daemon requires Linux (inotify)\n";
+    return 1;
+#endif
 }
 
 /**
- * Launches a new search thread or performs search directly if thread limit reached
+ * Sends the query to a running daemon and records the matches it returns
  */
-void launchSearch(const fs::path& directory, const std::vector<std::string>& filenamePatterns,
-    SearchMode mode, PatternType patternType) {
-    if (activeThreads >= maxThreads) {
-        // Execute directly if thread limit reached
-        searchInDirectory(directory, filenamePatterns, mode, patternType);
-        return;
+bool queryDaemon(const std::string& pattern, const std::string& scope) {
+#ifdef __linux__
+    const std::string path = daemonSocketPath();
+    int fd = connectToSocket(path);
+    if (fd < 0) {
+        std::cerr << "Error: No qfs daemon is listening on " << path << "\n";
+        return false;
     }
 
-    // Launch new thread for directory search
-    std::lock_guard<std::mutex> lock(threadsMutex);
-    activeThreads++;
+    std::string request = std::string("Q ") + (searchDirectories ? "1" : "0") + "\t" + scope + "\t" + pattern + "\n";
+    if (!sendAll(fd, request)) {
+        close(fd);
+        return false;
+    }
 
-    threads.emplace_back([directory, filenamePatterns, mode, patternType]() {
-        searchInDirectory(directory, filenamePatterns, mode, patternType);
-        activeThreads--;
-        threadsCV.notify_one();
-        });
+    std::string line;
+    std::string pending;
+    bool ok = true;
+    while (!searchCancelled && receiveLine(fd, line, pending)) {
+        if (line.size() < 2) {
+            continue;
+        }
+        if (line[0] == 'E') {
+            std::cerr << "Error: " << line.substr(2) << "\n";
+            ok = false;
+            continue;
+        }
+        std::string entryPath = line.substr(2);
+        size_t slash = entryPath.find_last_of('/');
+        uint32_t nameOffset = static_cast<uint32_t>(slash == std::string::npos ? 0 : slash + 1);
+        if (metadataFilter.active() && !metadataFilter.matches(entryPath)) {
+            continue;
+        }
+        recordMatch({ std::move(entryPath), nameOffset, line[0] == 'D' });
+    }
+    close(fd);
+    return ok;
+#else
+    (void)pattern;
+    (void)scope;
+    std::cerr << "Error: --client requires Linux\n";
+    return false;
+#endif
 }
 
 /**
@@ -501,6 +6969,7 @@ void getInteractiveInput(std::vector<std::string>& targetPatterns, std::string&
         std::cout << "Enter file name patterns to search for:\n";
         std::cout << "  Simple patterns: 'hello&&.txt' (case-insensitive substring)\n";
         std::cout << "  Regex patterns: '/.*\\.(txt|pdf)/' (wrap regex in /.../)\n";
+        std::cout << "  Glob patterns: 'glob:*.tar.gz' (whole name; *, ? and {a,b})\n";
         std::cout << "Note: In regex, use \\. for literal dot, \\\\ for backslash\n";
         std::cout << "Logical operators:\n";
         std::cout << "  - pattern1&&pattern2  (AND - match ALL patterns)\n";
@@ -522,11 +6991,15 @@ void getInteractiveInput(std::vector<std::string>& targetPatterns, std::string&
     else if (searchMode == SearchMode::OR) {
         modeStr = "OR (match any pattern)";
     }
+    else if (searchMode == SearchMode::EXPRESSION) {
+        modeStr = "EXPRESSION (boolean combination of patterns)";
+    }
     else {
         modeStr = "SINGLE (match one pattern)";
     }
 
-    std::string typeStr = (patternType == PatternType::REGEX) ? "REGEX" : "SIMPLE";
+    std::string typeStr = (patternType == PatternType::REGEX) ? "REGEX"
+        : (patternType == PatternType::GLOB) ? "GLOB" : "SIMPLE";
 
     std::cout << "\nSearch mode: " << modeStr << "\n";
     std::cout << "Pattern type: " << typeStr << "\n";
@@ -570,6 +7043,18 @@ void getInteractiveInput(std::vector<std::string>& targetPatterns, std::string&
     searchDirectories = (input == "y" || input == "Y");
 }
 
+/**
+ * Removes trailing separators except from a root ("/", "C:\\"), so a directory
+ * has one spelling as a path prefix and as a key of its children's parent
+ */
+void stripTrailingSeparators(std::string& directory) {
+    const size_t rootLength = fs::path(directory).root_path().string().size();
+    while (directory.size() > std::max<size_t>(rootLength, 1) &&
+        (directory.back() == '/' || directory.back() == static_cast<char>(fs::path::preferred_separator))) {
+        directory.pop_back();
+    }
+}
+
 /**
  * Validates and normalizes the starting directory path
  */
@@ -585,6 +7070,7 @@ bool setupStartingDirectory(std::string& startingDir) {
             dirPath = fs::absolute(dirPath);
         }
         startingDir = dirPath.string();
+        stripTrailingSeparators(startingDir);
 
         if (!fs::exists(startingDir)) {
             std::cerr << "Error: Starting directory does not exist!\n";
@@ -604,10 +7090,38 @@ bool setupStartingDirectory(std::string& startingDir) {
     }
 }
 
+/**
+ * Saves each --queries line's results to its own file, named after
+ * outputFilename with the 1-based query number before the extension
+ * (results.txt becomes results.1.txt, results.2.txt, ...)
+ */
+bool saveResultsPerQuery(const std::string& outputFilename) {
+    const fs::path base(outputFilename);
+    std::vector<std::ofstream> outputFiles(batchQueries.size());
+    for (size_t i = 0; i < batchQueries.size(); i++) {
+        fs::path filename = base.parent_path() /
+            (base.stem().string() + "." + std::to_string(i + 1) + base.extension().string());
+        outputFiles[i].open(filename);
+        if (!outputFiles[i].is_open()) {
+            std::cerr << "Error: Failed to create results file '" << filename.string() << "'!\n";
+            return false;
+        }
+    }
+
+    for (const auto& result : searchResults) {
+        outputFiles[result.query] << formatMatch(result, false) << "\n";
+    }
+    return true;
+}
+
 /**
  * Saves search results to file
  */
 bool saveResultsToFile(const std::string& outputFilename) {
+    if (splitSaveByQuery) {
+        return saveResultsPerQuery(outputFilename);
+    }
+
     std::ofstream outputFile(outputFilename);
     if (!outputFile.is_open()) {
         std::cerr << "Error: Failed to create results file '" << outputFilename << "'!\n";
@@ -615,7 +7129,7 @@ bool saveResultsToFile(const std::string& outputFilename) {
     }
 
     for (const auto& result : searchResults) {
-        outputFile << result << "\n";
+        outputFile << formatMatch(result) << "\n";
     }
     return true;
 }
@@ -624,6 +7138,8 @@ int main(int argc, char* argv[]) {
     std::vector<std::string> targetPatterns;
     std::string startingDir;
     bool interactiveMode = (argc == 1);
+    RunMode runMode = RunMode::SEARCH;
+    std::string rawPattern;                  // Pattern as typed, forwarded by --client
     SearchMode searchMode = SearchMode::OR;
     PatternType patternType = PatternType::SIMPLE;
 
@@ -639,35 +7155,130 @@ int main(int argc, char* argv[]) {
         saveFilename.clear();
         searchDirectories = false;
 
-        if (!validateArguments(argc, argv, targetPatterns, startingDir, searchMode, patternType)) {
+        std::string firstArg = argv[1];
+        if (firstArg == "--index") {
+            if (!validateIndexArguments(argc, argv, runMode, targetPatterns, startingDir,
+                searchMode, patternType)) {
+                return 1;
+            }
+        }
+        else if (firstArg == "--queries") {
+            if (!validateQueriesArguments(argc, argv, startingDir)) {
+                return 1;
+            }
+        }
+        else if (firstArg == "--daemon" || firstArg == "--client") {
+            if (!validateDaemonArguments(argc, argv, runMode, rawPattern, targetPatterns, startingDir,
+                searchMode, patternType)) {
+                return 1;
+            }
+        }
+        else if (!validateArguments(argc, argv, targetPatterns, startingDir, searchMode, patternType)) {
             return 1;
         }
     }
 
-    // Setup and validate starting directory
-    if (!setupStartingDirectory(startingDir)) {
+    if ((maxResults != 0 || !contentPattern.empty() || !metadataOptions.empty()) && (runMode == RunMode::INDEX_BUILD ||
+        runMode == RunMode::INDEX_UPDATE || runMode == RunMode::DAEMON)) {
+        std::cerr << "Error: Result filters and limits only apply to searches and queries\n";
+        return 1;
+    }
+    if ((sameFileSystem || !skipFileSystemTypes.empty()) &&
+        (runMode == RunMode::INDEX_QUERY || runMode == RunMode::CLIENT)) {
+        std::cerr << "Error: --xdev and --skip-fstype only apply to file system walks\n";
+        return 1;
+    }
+    if ((!excludePatterns.empty() || useIgnoreFiles) && runMode != RunMode::SEARCH) {
+        std::cerr << "Error: --exclude and --ignore-files only apply to file system searches\n";
+        return 1;
+    }
+    if (splitSaveByQuery && (batchQueries.empty() || saveFilename.empty())) {
+        std::cerr << "Error: --split requires --queries and --save\n";
+        return 1;
+    }
+    if (ioBackend == IoBackend::URING && !ioUringAvailable()) {
+        std::cerr << "Warning: io_uring is not available, using the synchronous reader\n";
+        ioBackend = IoBackend::SYNC;
+    }
+
+    // Setup and validate starting directory (index and daemon queries are only scoped by an explicit --dir)
+    const bool storedTree = runMode == RunMode::INDEX_QUERY || runMode == RunMode::CLIENT;
+    bool scopedQuery = !startingDir.empty();
+    if (runMode == RunMode::INDEX_UPDATE) {
+        return updateIndex(); // The index records its own root
+    }
+    if ((!storedTree || scopedQuery) && !setupStartingDirectory(startingDir)) {
         return 1;
     }
+    if (!storedTree) {
+        mountFilter.configure(startingDir, sameFileSystem, skipFileSystemTypes);
+    }
+
+    if (runMode == RunMode::INDEX_BUILD) {
+        return buildIndex(startingDir);
+    }
+    if (runMode == RunMode::DAEMON) {
+        return runDaemon(startingDir);
+    }
 
-    // Begin search
-    searchInDirectory(startingDir, targetPatterns, searchMode, patternType);
+    // Compile patterns once; regex syntax errors are reported here rather than per file
+    Matcher matcher;
+    if (batchQueries.empty() ? !matcher.compile(targetPatterns, searchMode, patternType)
+        : !matcher.compileQueries(batchQueries)) {
+        std::cerr << "Error: Invalid search pattern\n";
+        return 1;
+    }
 
-    // Wait for all threads to complete
-    {
-        std::unique_lock<std::mutex> lock(threadsMutex);
-        threadsCV.wait(lock, [] { return activeThreads == 0; });
+    for (const auto& option : metadataOptions) {
+        if (!metadataFilter.add(option.first, option.second)) {
+            return 1;
+        }
     }
 
-    // Clean up threads
-    for (auto& thread : threads) {
-        if (thread.joinable()) {
-            thread.join();
+    for (const auto& pattern : excludePatterns) {
+        if (!excludeRules.add(pattern)) {
+            std::cerr << "Error: Invalid --exclude pattern '" << pattern << "'\n";
+            return 1;
         }
     }
-    threads.clear();
+    if (useIgnoreFiles) {
+        excludeRules.add(".git/"); // Like git, also skip the repository directories themselves
+    }
+
+    ContentMatcher contentMatcher;
+    if (!contentPattern.empty() && !contentMatcher.compile(contentPattern)) {
+        std::cerr << "Error: Invalid content pattern\n";
+        return 1;
+    }
+
+    IndexReader index;
+    if (runMode == RunMode::INDEX_QUERY && !index.open(indexFilename)) {
+        return 1;
+    }
+
+    if (printDuringSearch) {
+        consoleWriter.start();
+    }
+    if (!contentPattern.empty()) {
+        contentPool.start(contentMatcher, maxThreads);
+    }
+
+    // Begin search and wait for the pool (or the index scan, or the daemon) to finish
+    bool succeeded = true;
+    if (runMode == RunMode::INDEX_QUERY) {
+        queryIndex(index, matcher, scopedQuery ? startingDir : std::string());
+    }
+    else if (runMode == RunMode::CLIENT) {
+        succeeded = queryDaemon(rawPattern, scopedQuery ? startingDir : std::string());
+    }
+    else {
+        runTraversal(startingDir, matcher);
+    }
+    contentPool.finish();
+    consoleWriter.stop();
 
-    // Sort results but do not print count or summary
-    std::sort(searchResults.begin(), searchResults.end());
+    // Merge the per-worker results sorted by path, but do not print count or summary
+    searchResults = resultCollector.merge();
 
     // Save to file if requested (no confirmation message printed)
     if (!saveFilename.empty()) {
@@ -679,5 +7290,5 @@ int main(int argc, char* argv[]) {
         std::cin.ignore();
     }
 
-    return 0;
+    return succeeded ? 0 : 1;
 }